@@ -0,0 +1,307 @@
+/**************************************************************
+ *
+ *                     code.c
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Decodes UM programs ahead of time and keeps the decoded form 
+ *              of the most recently used ones. Programs are found by a 
+ *              fingerprint of their words, so loading a segment with the 
+ *              same contents as an earlier one reuses its decoded form 
+ *              instead of decoding it again.
+ *
+ **************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <bitpack.h>
+#include "assert.h"
+#include "code.h"
+
+/* The opcode of LV, the only instruction with a different layout */
+#define LV_OPCODE 13
+/* The opcodes that get an inline cache site */
+#define SLOAD_OPCODE 1
+#define SSTORE_OPCODE 2
+/* Parameters of the 64-bit FNV-1a hash */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+/* Number of words a fingerprint takes per step, two for each of its four
+   hash lanes */
+#define HASH_STEP 8
+
+/*   code_entry
+ *   A decoded program in the cache
+ *    
+ *   Elements:
+ *      uint64_t serial:       names the entry, never reused by another
+ *      uint64_t fingerprint:  the hash of the words of the program
+ *      unsigned length:       the number of words in the program
+ *      um_instruction *words: a copy of the words, to rule out collisions
+ *      um_decoded *decoded:   the decoded form of each word
+ *      unsigned num_sites:    the number of SLOAD and SSTORE instructions
+ *      uint64_t last_used:    when the entry was last returned, for LRU
+ *  
+ */
+struct code_entry {
+        uint64_t serial;
+        uint64_t fingerprint;
+        unsigned length;
+        um_instruction *words;
+        um_decoded *decoded;
+        unsigned num_sites;
+        uint64_t last_used;
+};
+
+typedef struct code_entry code_entry;
+
+/*   code_cache
+ *   A bounded cache of decoded programs, evicted least recently used first
+ *    
+ *   Elements:
+ *      code_entry *entries: the cached programs
+ *      unsigned capacity:   the most programs kept at once
+ *      unsigned count:      the number of programs currently kept
+ *      uint64_t clock:      counts lookups, to order entries by use
+ *      uint64_t next_serial: the serial the next new entry gets
+ *  
+ */
+struct code_cache {
+        code_entry *entries;
+        unsigned capacity;
+        unsigned count;
+        uint64_t clock;
+        uint64_t next_serial;
+};
+
+/********** decode_word ********
+* Purpose:
+*      Extracts the fields of an instruction word
+* Inputs:
+*      um_instruction word: The instruction word
+*      um_decoded *decoded: Where the fields are stored
+* Return/Effects:
+*      Fills in the opcode, registers and value of the instruction
+* Expects:
+*      
+* Notes
+*      Invalid opcodes are decoded as well. They are only rejected if they 
+*      are executed.
+************************/
+void decode_word(um_instruction word, um_decoded *decoded)
+{
+        assert(decoded != NULL);
+        decoded->opcode = Bitpack_getu(word, 4, 28);
+        if (decoded->opcode == LV_OPCODE) {
+                decoded->A = Bitpack_getu(word, 3, 25);
+                decoded->B = 0;
+                decoded->C = 0;
+                decoded->value = Bitpack_getu(word, 25, 0);
+        } else {
+                decoded->A = Bitpack_getu(word, 3, 6);
+                decoded->B = Bitpack_getu(word, 3, 3);
+                decoded->C = Bitpack_getu(word, 3, 0);
+                decoded->value = 0;
+        }
+}
+
+
+/********** fingerprint ********
+* Purpose:
+*      Hashes the words of a program
+* Inputs:
+*      const um_instruction *words: The words of the program
+*      unsigned length: The number of words
+* Return/Effects:
+*      Returns a 64-bit hash of the words
+* Expects:
+*      
+* Notes
+*      Four FNV-1a lanes each take a pair of words per step, and are 
+*      combined at the end. A single FNV chain waits on a multiply for 
+*      every word, while the lanes are independent and overlap. Matches are
+*      still compared in full, so the hash only has to spread programs out.
+************************/
+static uint64_t fingerprint(const um_instruction *words, unsigned length)
+{
+        uint64_t h0 = FNV_OFFSET;
+        uint64_t h1 = FNV_OFFSET + 1;
+        uint64_t h2 = FNV_OFFSET + 2;
+        uint64_t h3 = FNV_OFFSET + 3;
+        unsigned i = 0;
+        for (; i + HASH_STEP <= length; i += HASH_STEP) {
+                h0 = (h0 ^ (words[i] | (uint64_t) words[i + 1] << 32)) * 
+                                                                FNV_PRIME;
+                h1 = (h1 ^ (words[i + 2] | (uint64_t) words[i + 3] << 32)) *
+                                                                FNV_PRIME;
+                h2 = (h2 ^ (words[i + 4] | (uint64_t) words[i + 5] << 32)) *
+                                                                FNV_PRIME;
+                h3 = (h3 ^ (words[i + 6] | (uint64_t) words[i + 7] << 32)) *
+                                                                FNV_PRIME;
+        }
+        for (; i < length; i++) {
+                h0 = (h0 ^ words[i]) * FNV_PRIME;
+        }
+        uint64_t hash = (FNV_OFFSET ^ length) * FNV_PRIME;
+        hash = (hash ^ h0) * FNV_PRIME;
+        hash = (hash ^ h1) * FNV_PRIME;
+        hash = (hash ^ h2) * FNV_PRIME;
+        hash = (hash ^ h3) * FNV_PRIME;
+        return hash ^ (hash >> 32);
+}
+
+
+/********** code_cache_new ********
+* Purpose:
+*      Creates an empty code cache
+* Inputs:
+*      unsigned capacity: The most programs the cache keeps at once
+* Return/Effects:
+*      Returns the new cache
+* Expects:
+*      capacity to be at least 1
+* Notes
+*      
+************************/
+code_cache *code_cache_new(unsigned capacity)
+{
+        assert(capacity > 0);
+        code_cache *cache = malloc(sizeof(*cache));
+        assert(cache != NULL);
+        cache->entries = calloc(capacity, sizeof(code_entry));
+        assert(cache->entries != NULL);
+        cache->capacity = capacity;
+        cache->count = 0;
+        cache->clock = 0;
+        cache->next_serial = 1;
+        return cache;
+}
+
+
+/********** code_cache_free ********
+* Purpose:
+*      Frees a code cache
+* Inputs:
+*      code_cache **cache: The cache being freed
+* Return/Effects:
+*      Frees every cached program and the cache, and sets *cache to NULL
+* Expects:
+*      
+* Notes
+*      
+************************/
+void code_cache_free(code_cache **cache)
+{
+        assert(cache != NULL && *cache != NULL);
+        for (unsigned i = 0; i < (*cache)->count; i++) {
+                free((*cache)->entries[i].words);
+                free((*cache)->entries[i].decoded);
+        }
+        free((*cache)->entries);
+        free(*cache);
+        *cache = NULL;
+}
+
+
+/********** code_cache_get ********
+* Purpose:
+*      Finds the decoded form of a program
+* Inputs:
+*      code_cache *cache: The cache of decoded programs
+*      const um_instruction *words: The words of the program
+*      unsigned length: The number of words
+*      uint64_t *serial: The entry the words are known to match, or 0. 
+*                        Replaced by the entry that was returned.
+*      unsigned *num_sites: Where to store the number of cache sites
+*      bool *hit: Where to store whether the program was already cached
+* Return/Effects:
+*      Returns the decoded program. On a miss the program is decoded and 
+*      cached, evicting the least recently used program if the cache is full.
+* Expects:
+*      A nonzero *serial to come from an earlier call for the same words, 
+*      unchanged since
+* Notes
+*      If the entry named by *serial is still cached it is returned without
+*      hashing or comparing the words. Otherwise the words are fingerprinted
+*      and compared in full.
+*      The decoded program belongs to the cache. It must not be changed and 
+*      is only valid until the next call, which may evict it. Each SLOAD and
+*      SSTORE is numbered as an inline cache site, counting from 1, so the 
+*      machine only needs caches for the words that can use them.
+************************/
+const um_decoded *code_cache_get(code_cache *cache, 
+                const um_instruction *words, unsigned length, 
+                uint64_t *serial, unsigned *num_sites, bool *hit)
+{
+        assert(cache != NULL);
+        assert(words != NULL);
+        assert(serial != NULL);
+        assert(num_sites != NULL);
+        assert(hit != NULL);
+        cache->clock++;
+        for (unsigned i = 0; i < cache->count && *serial != 0; i++) {
+                code_entry *entry = &cache->entries[i];
+                if (entry->serial == *serial) {
+                        assert(entry->length == length);
+                        entry->last_used = cache->clock;
+                        *num_sites = entry->num_sites;
+                        *hit = true;
+                        return entry->decoded;
+                }
+        }
+        uint64_t hash = fingerprint(words, length);
+        for (unsigned i = 0; i < cache->count; i++) {
+                code_entry *entry = &cache->entries[i];
+                if (entry->fingerprint == hash && entry->length == length &&
+                    memcmp(entry->words, words, 
+                                length * sizeof(um_instruction)) == 0) {
+                        entry->last_used = cache->clock;
+                        *serial = entry->serial;
+                        *num_sites = entry->num_sites;
+                        *hit = true;
+                        return entry->decoded;
+                }
+        }
+        /* Take a free entry, or the least recently used one */
+        code_entry *entry;
+        if (cache->count < cache->capacity) {
+                entry = &cache->entries[cache->count++];
+        } else {
+                entry = &cache->entries[0];
+                for (unsigned i = 1; i < cache->count; i++) {
+                        if (cache->entries[i].last_used < entry->last_used) {
+                                entry = &cache->entries[i];
+                        }
+                }
+                free(entry->words);
+                free(entry->decoded);
+        }
+        entry->serial = cache->next_serial++;
+        entry->fingerprint = hash;
+        entry->length = length;
+        entry->last_used = cache->clock;
+        entry->words = malloc((length > 0 ? length : 1) * 
+                                                sizeof(um_instruction));
+        assert(entry->words != NULL);
+        memcpy(entry->words, words, length * sizeof(um_instruction));
+        entry->decoded = malloc((length > 0 ? length : 1) * 
+                                                        sizeof(um_decoded));
+        assert(entry->decoded != NULL);
+        entry->num_sites = 0;
+        for (unsigned i = 0; i < length; i++) {
+                um_decoded *ins = &entry->decoded[i];
+                decode_word(words[i], ins);
+                if (ins->opcode == SLOAD_OPCODE || 
+                                        ins->opcode == SSTORE_OPCODE) {
+                        ins->value = ++entry->num_sites;
+                }
+        }
+        *serial = entry->serial;
+        *num_sites = entry->num_sites;
+        *hit = false;
+        return entry->decoded;
+}
@@ -0,0 +1,50 @@
+/**************************************************************
+ *
+ *                     code.h
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Interface of the code module, which decodes programs and 
+ *              caches the decoded form of recently loaded ones
+ *
+ **************************************************************/
+#ifndef CODE_H_INCLUDED
+#define CODE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory.h"
+
+/*   um_decoded
+ *   An instruction word with its fields already extracted
+ *    
+ *   Elements:
+ *      uint8_t opcode:  the 4-bit opcode
+ *      uint8_t A, B, C: the register fields. For LV, A is the register 
+ *                       in bits 25 to 27 and B and C are unused.
+ *      uint32_t value:  the value loaded by LV, or for SLOAD and SSTORE 
+ *                       the inline cache site of the instruction
+ *  
+ */
+struct um_decoded {
+        uint8_t opcode;
+        uint8_t A;
+        uint8_t B;
+        uint8_t C;
+        uint32_t value;
+};
+
+typedef struct um_decoded um_decoded;
+
+typedef struct code_cache code_cache;
+
+void decode_word(um_instruction word, um_decoded *decoded);
+code_cache *code_cache_new(unsigned capacity);
+void code_cache_free(code_cache **cache);
+const um_decoded *code_cache_get(code_cache *cache, 
+                const um_instruction *words, unsigned length, 
+                uint64_t *serial, unsigned *num_sites, bool *hit);
+
+#endif
@@ -11,47 +11,178 @@
  *              modules to run the UM.
  *
  **************************************************************/
+#define _POSIX_C_SOURCE 200809L
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <seq.h>
 #include <uarray.h>
-#include <sys/stat.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <bitpack.h>
 #include "memory.h"
 #include "assert.h"
 #include "instructions.h"
+#include "perf.h"
+#include "ensemble.h"
 
-/* Number of registers */
-#define NUM_REGISTERS 8
 /* The initial program counter */
 #define INITIAL_COUNTER 0
+/* Number of decoded programs kept for LOADP to reuse */
+#define CODE_CACHE_ENTRIES 8
 /* The index of the zero segment */
 #define ZERO_SEGMENT 0
+/* Number of bytes read from the program stream at a time */
+#define LOAD_CHUNK 262144
+/* Filename that stands for the program being read from stdin */
+#define STDIN_FILENAME "-"
+/* Flag that turns on the stats mode */
+#define STATS_FLAG "--stats"
+/* Flag that measures the run with hardware performance counters */
+#define PERF_FLAG "--perf-counters"
+/* Flag that runs the program once per input file, in lockstep */
+#define ENSEMBLE_FLAG "--ensemble"
+/* Flags that record the I/O of a run to a file, or replay it from one */
+#define RECORD_FLAG "--record"
+#define REPLAY_FLAG "--replay"
+/* Suffix of the file each ensemble run writes its output to */
+#define OUTPUT_SUFFIX ".out"
 
-void initialize_machine_state(machine_state *ms, FILE *fp, char *filename);
+void initialize_machine_state(machine_state *ms, FILE *fp);
+void copy_machine_state(machine_state *ms, machine_state *image);
+void setup_machine_state(machine_state *ms, Seq_T memory, Seq_T unmapped);
+unsigned read_program(Seq_T memory, FILE *fp);
+int run_ensemble(machine_state *image, char **inputs, int num_inputs);
+void run_batch(machine_state *image, char **inputs, int count);
+bool run_isolated(machine_state *image, char **inputs, int count);
 void drive_program(machine_state *ms);
 void free_program(machine_state *ms);
+int usage(void);
 
 int main(int argc, char *argv[])
 {
-        if (argc != 2) {
-                fprintf(stderr, "Invalid usage. Try: ./um [um binary file]\n");
-                return EXIT_FAILURE;
+        char *positional[argc];
+        int num_positional = 0;
+        bool stats_mode = false;
+        bool perf_mode = false;
+        bool ensemble_mode = false;
+        char *record_file = NULL;
+        char *replay_file = NULL;
+        for (int i = 1; i < argc; i++) {
+                if (strcmp(argv[i], RECORD_FLAG) == 0) {
+                        if (++i == argc) {
+                                return usage();
+                        }
+                        record_file = argv[i];
+                } else if (strcmp(argv[i], REPLAY_FLAG) == 0) {
+                        if (++i == argc) {
+                                return usage();
+                        }
+                        replay_file = argv[i];
+                } else if (strcmp(argv[i], STATS_FLAG) == 0) {
+                        stats_mode = true;
+                } else if (strcmp(argv[i], PERF_FLAG) == 0) {
+                        perf_mode = true;
+                } else if (strcmp(argv[i], ENSEMBLE_FLAG) == 0) {
+                        ensemble_mode = true;
+                } else {
+                        positional[num_positional++] = argv[i];
+                }
         }
-        FILE *fp = fopen(argv[1], "rb");
+        /* An ensemble takes the program and at least one input file */
+        if (num_positional == 0 || (num_positional > 1) != ensemble_mode) {
+                return usage();
+        }
+        /* A run is either recorded or replayed, and ensembles are neither */
+        if (record_file != NULL && (replay_file != NULL || ensemble_mode)) {
+                return usage();
+        }
+        if (replay_file != NULL && ensemble_mode) {
+                return usage();
+        }
+        /* Stats and perf counters describe a single run */
+        if ((stats_mode || perf_mode) && ensemble_mode) {
+                return usage();
+        }
+        char *filename = positional[0];
+        /* A filename of "-" reads the program from stdin */
+        bool from_stdin = strcmp(filename, STDIN_FILENAME) == 0;
+        FILE *fp = from_stdin ? stdin : fopen(filename, "rb");
         assert(fp != NULL);
 
         machine_state ms;
-        initialize_machine_state(&ms, fp, argv[argc - 1]);
+        initialize_machine_state(&ms, fp);
+        if (!from_stdin) {
+                fclose(fp);
+        }
+        memory_install_fault_handler(&ms.program_counter);
+        if (ensemble_mode) {
+                int failed = run_ensemble(&ms, positional + 1, 
+                                                        num_positional - 1);
+                free_program(&ms);
+                return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (record_file != NULL) {
+                ms.session = session_record(record_file);
+        } else if (replay_file != NULL) {
+                ms.session = session_replay(replay_file);
+        }
+        /* In stats mode SIGUSR1 dumps the counters to stderr */
+        if (stats_mode) {
+                stats_install_signal(&ms.stats);
+        }
+        /* Only the run itself is measured, not loading or teardown */
+        perf_counters pc;
+        if (perf_mode) {
+                perf_open(&pc);
+                perf_start(&pc);
+        }
         drive_program(&ms);
+        if (perf_mode) {
+                perf_stop(&pc);
+                perf_report(stderr, &pc, &ms.stats);
+                perf_close(&pc);
+        }
+        /* A replay fails if its output differs from the recording */
+        bool replay_matched = true;
+        if (ms.session != NULL) {
+                fflush(ms.out);
+                replay_matched = session_close(&ms.session);
+        }
+        if (stats_mode) {
+                stats_dump(stderr, &ms.stats);
+        }
         free_program(&ms);
 
-        fclose(fp);
-        return EXIT_SUCCESS;
+        return replay_matched ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/********** usage ********
+* Purpose:
+*      Reports how the UM is meant to be run
+* Inputs:
+*      
+* Return/Effects:
+*      Prints the usage to stderr and returns EXIT_FAILURE
+* Expects:
+*      
+* Notes
+*      
+************************/
+int usage(void)
+{
+        fprintf(stderr, "Invalid usage. Try: ./um [--stats] [--perf-counters] "
+                                "[--record file | --replay file]\n"
+                        "                           [um binary file | -]\n"
+                        "       or: ./um --ensemble [um binary file | -] "
+                                        "[input file]...\n");
+        return EXIT_FAILURE;
 }
 
+
 /********** initialize_machine_state ********
 * Purpose:
 *      Initialize the initial state of the UM 
@@ -64,38 +195,82 @@ int main(int argc, char *argv[])
 *      A .um file with instructions
 * Notes
 *      This function will interact with the memory module using the 
-*      segment_new() function.
+*      segment_new() function. The file does not need to be a regular file,
+*      so pipes, FIFOs and stdin work as well.
 ************************/
-void initialize_machine_state(machine_state *ms, FILE *fp, char *filename) 
+void initialize_machine_state(machine_state *ms, FILE *fp) 
 {
         assert(ms != NULL);
         assert(fp != NULL);
-        /* Extract the size of the file using the stat method */
-        struct stat buf;          
-        int ret = stat(filename, &buf);
-        assert(ret == 0);
-        int filesize = buf.st_size;
-        /* Determine the number of instruction words based off the size  */
-        int numWords = filesize / 4;
         /* Initialize the sequences used in memory */
         Seq_T unmapped = Seq_new(0);
         assert(unmapped != NULL);
         Seq_T memory = Seq_new(0);
         assert(memory != NULL);
-        /* Initialize the zero segment */
+        /* Initialize the zero segment with room for the first chunk */
+        int segNum = segment_new(memory, unmapped, LOAD_CHUNK / 4);
+        assert(segNum == 0);
+        /* Stream the instructions into the zero segment */
+        unsigned numWords = read_program(memory, fp);
+        assert(numWords > 0);
+        setup_machine_state(ms, memory, unmapped);
+}
+
+
+/********** copy_machine_state ********
+* Purpose:
+*      Initialize a UM that runs the same program as another
+* Inputs:
+*       machine_state *ms: The machine state being initialized
+*       machine_state *image: A machine that has not started running yet
+* Return/Effects:
+*      The machine state struct will be initialized with its own copy of 
+*      the zero segment of image
+* Expects:
+*      image to have been set up by initialize_machine_state
+* Notes
+*      Lets one loaded program be run many times without reading it again.
+************************/
+void copy_machine_state(machine_state *ms, machine_state *image)
+{
+        assert(ms != NULL);
+        assert(image != NULL);
+        Seq_T unmapped = Seq_new(0);
+        assert(unmapped != NULL);
+        Seq_T memory = Seq_new(0);
+        assert(memory != NULL);
+        unsigned numWords = num_instructions(image->memory);
         int segNum = segment_new(memory, unmapped, numWords);
         assert(segNum == 0);
-        /* Construct the instruction word using the bit pack interface */
-        for (int i = 0; i < numWords; i++) {
-                um_instruction word = 0;
-                word = Bitpack_newu(word, 8, 24, getc(fp));
-                word = Bitpack_newu(word, 8, 16, getc(fp));
-                word = Bitpack_newu(word, 8, 8, getc(fp));
-                word = Bitpack_newu(word, 8, 0, getc(fp));
-                /* Insert the instruction into the zero segment */
-                um_instruction *location = segment_at(memory, ZERO_SEGMENT, i);
-                *location = word;
+        for (unsigned i = 0; i < numWords; i++) {
+                *segment_at(memory, ZERO_SEGMENT, i) = 
+                                *segment_at(image->memory, ZERO_SEGMENT, i);
         }
+        setup_machine_state(ms, memory, unmapped);
+}
+
+
+/********** setup_machine_state ********
+* Purpose:
+*      Fills in the parts of a UM that do not depend on the program
+* Inputs:
+*       machine_state *ms: The machine state being initialized
+*	Seq_T memory: The sequence storing all the segments
+*	Seq_T unmapped: The sequence storing the unmapped segment indices
+* Return/Effects:
+*      Initializes the registers, program counter, inline caches, stats and 
+*      decoded program, and connects the machine to stdin and stdout with 
+*      no session
+* Expects:
+*      The zero segment of memory to hold the program
+* Notes
+*      
+************************/
+void setup_machine_state(machine_state *ms, Seq_T memory, Seq_T unmapped)
+{
+        assert(ms != NULL);
+        assert(memory != NULL);
+        assert(unmapped != NULL);
         /* Initialize the array of registers */
         UArray_T registers = UArray_new(NUM_REGISTERS, sizeof(uint32_t));
         assert(registers != NULL);
@@ -104,6 +279,80 @@ void initialize_machine_state(machine_state *ms, FILE *fp, char *filename)
         ms->unmapped = unmapped;
         ms->registers = registers;
         ms->program_counter = INITIAL_COUNTER;
+        ms->caches = NULL;
+        ms->num_caches = 0;
+        ms->segments = NULL;
+        ms->num_segments = 0;
+        track_segment(ms, ZERO_SEGMENT);
+        memset(&ms->stats, 0, sizeof(ms->stats));
+        stats_map(&ms->stats, num_instructions(memory));
+        /* Decode the program, keeping it in case it is loaded again */
+        ms->code = code_cache_new(CODE_CACHE_ENTRIES);
+        ms->private_program = NULL;
+        prepare_program(ms, ZERO_SEGMENT);
+        ms->in = stdin;
+        ms->out = stdout;
+        ms->session = NULL;
+}
+
+
+/********** read_program ********
+* Purpose:
+*      Reads the instruction words of a .um program into the zero segment
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*	File *file: The input .um program
+* Return/Effects:
+*      Returns the number of instruction words read. The zero segment is 
+*      grown in large chunks as data arrives and is trimmed to exactly that 
+*      many words at the end of the stream.
+* Expects:
+*      The zero segment to already be mapped
+* Notes
+*      The size of the program is never asked for up front, so it does not
+*      matter whether the stream is seekable. A trailing partial word is 
+*      ignored.
+************************/
+unsigned read_program(Seq_T memory, FILE *fp)
+{
+        assert(memory != NULL);
+        assert(fp != NULL);
+        unsigned char *bytes = malloc(LOAD_CHUNK);
+        assert(bytes != NULL);
+        unsigned capacity = num_instructions(memory);
+        unsigned loaded = 0;
+        size_t pending = 0;
+        size_t n;
+        while ((n = fread(bytes + pending, 1, LOAD_CHUNK - pending, fp)) > 0) {
+                pending += n;
+                unsigned words = pending / 4;
+                /* Double the zero segment until the new words fit */
+                if (loaded + words > capacity) {
+                        while (loaded + words > capacity) {
+                                capacity *= 2;
+                        }
+                        segment_resize(memory, ZERO_SEGMENT, capacity);
+                }
+                /* Construct the instruction word using the bit pack interface */
+                for (unsigned i = 0; i < words; i++) {
+                        unsigned char *src = bytes + 4 * i;
+                        um_instruction word = 0;
+                        word = Bitpack_newu(word, 8, 24, src[0]);
+                        word = Bitpack_newu(word, 8, 16, src[1]);
+                        word = Bitpack_newu(word, 8, 8, src[2]);
+                        word = Bitpack_newu(word, 8, 0, src[3]);
+                        /* Insert the instruction into the zero segment */
+                        *segment_at(memory, ZERO_SEGMENT, loaded + i) = word;
+                }
+                loaded += words;
+                /* Carry a partially read word over to the next chunk */
+                memmove(bytes, bytes + 4 * words, pending - 4 * words);
+                pending -= 4 * words;
+        }
+        assert(!ferror(fp));
+        free(bytes);
+        segment_resize(memory, ZERO_SEGMENT, loaded);
+        return loaded;
 }
 
 
@@ -126,25 +375,147 @@ void drive_program(machine_state *ms)
         assert(ms != NULL);  
         bool drive = true;
         while (drive && ms->program_counter < num_instructions(ms->memory)) {
-                /* Grab the current instruction in the zero segment */
-                um_instruction word = *segment_at(ms->memory, 0, 
-                                                        ms->program_counter);
+                /* Grab the current instruction, already decoded */
+                um_decoded ins = ms->program[ms->program_counter];
                 /* Update the program counter */
                 ms->program_counter++;
                 /* Perform the instruction */
-                drive = handle_instruction(word, ms);
+                drive = handle_instruction(ins, ms);
         }
         assert(!drive);
 }
 
 
+/********** run_ensemble ********
+* Purpose:
+*      Runs a program once for each of a list of input files
+* Inputs:
+*      machine_state *image: The loaded program, which is not run itself
+*      char **inputs: The input file of each run
+*      int num_inputs: The number of input files
+* Return/Effects:
+*      Each run reads its input file and writes its output to the same name
+*      with ".out" added. Returns the number of runs that failed, each of 
+*      which is also reported on stderr.
+* Expects:
+*      
+* Notes
+*      Runs are done ENSEMBLE_LANES at a time in lockstep, each batch in a 
+*      child process of its own. A run that fails (a UM fault, a failed 
+*      assertion or an invalid instruction) takes down only its batch. The 
+*      batch is then run again one input per child process, so every run 
+*      that can finish does and only the failing runs are lost. The output
+*      file of a failed run holds whatever it wrote before failing.
+************************/
+int run_ensemble(machine_state *image, char **inputs, int num_inputs)
+{
+        assert(image != NULL);
+        assert(inputs != NULL);
+        int failed = 0;
+        for (int first = 0; first < num_inputs; first += ENSEMBLE_LANES) {
+                int count = num_inputs - first;
+                if (count > ENSEMBLE_LANES) {
+                        count = ENSEMBLE_LANES;
+                }
+                if (run_isolated(image, inputs + first, count)) {
+                        continue;
+                }
+                for (int l = 0; l < count; l++) {
+                        if (!run_isolated(image, inputs + first + l, 1)) {
+                                fprintf(stderr, "um: ensemble run of %s "
+                                        "failed\n", inputs[first + l]);
+                                failed++;
+                        }
+                }
+        }
+        return failed;
+}
+
+
+/********** run_isolated ********
+* Purpose:
+*      Runs a batch of an ensemble in a child process
+* Inputs:
+*      machine_state *image: The loaded program
+*      char **inputs: The input file of each run in the batch
+*      int count: The number of runs in the batch
+* Return/Effects:
+*      Returns whether every run in the batch finished
+* Expects:
+*      Between 1 and ENSEMBLE_LANES runs
+* Notes
+*      The child gets a copy on write view of image, so nothing is loaded 
+*      again. stdout and stderr are flushed first so nothing buffered is 
+*      written twice.
+************************/
+bool run_isolated(machine_state *image, char **inputs, int count)
+{
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+                run_batch(image, inputs, count);
+                exit(EXIT_SUCCESS);
+        }
+        int status;
+        pid_t ret = waitpid(pid, &status, 0);
+        assert(ret == pid);
+        return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+
+/********** run_batch ********
+* Purpose:
+*      Runs a batch of an ensemble
+* Inputs:
+*      machine_state *image: The loaded program
+*      char **inputs: The input file of each run in the batch
+*      int count: The number of runs in the batch
+* Return/Effects:
+*      Runs the batch in lockstep, then finishes the runs that split off 
+*      one at a time
+* Expects:
+*      Between 1 and ENSEMBLE_LANES runs
+* Notes
+*      This function will interact with the ensemble module using the
+*      drive_ensemble function. 
+************************/
+void run_batch(machine_state *image, char **inputs, int count)
+{
+        machine_state lanes[ENSEMBLE_LANES];
+        bool halted[ENSEMBLE_LANES];
+        for (int l = 0; l < count; l++) {
+                char output[strlen(inputs[l]) + sizeof(OUTPUT_SUFFIX)];
+                sprintf(output, "%s%s", inputs[l], OUTPUT_SUFFIX);
+                copy_machine_state(&lanes[l], image);
+                lanes[l].in = fopen(inputs[l], "rb");
+                assert(lanes[l].in != NULL);
+                lanes[l].out = fopen(output, "wb");
+                assert(lanes[l].out != NULL);
+        }
+        drive_ensemble(lanes, halted, count);
+        for (int l = 0; l < count; l++) {
+                if (!halted[l]) {
+                        memory_set_fault_counter(&lanes[l].program_counter);
+                        drive_program(&lanes[l]);
+                }
+                fclose(lanes[l].in);
+                fclose(lanes[l].out);
+                free_program(&lanes[l]);
+        }
+        memory_set_fault_counter(&image->program_counter);
+}
+
+
 /********** free_program ********
 * Purpose:
 *      Clean up all the memory allocated to conduct the UM
 * Inputs:
 *      machine_state *ms: The machine state struct that holds the UM ADT’s
 * Return/Effects:
-*      Frees the memory sequences and the register array
+*      Frees the memory sequences, the register array, the inline caches 
+*      and the decoded programs
 * Expects:
 *      
 * Notes
@@ -156,4 +527,8 @@ void free_program(machine_state *ms)
         assert(ms != NULL);
         free_memory(ms->memory, ms->unmapped);
         UArray_free(&ms->registers);
+        free(ms->caches);
+        free(ms->segments);
+        free(ms->private_program);
+        code_cache_free(&ms->code);
 }
\ No newline at end of file
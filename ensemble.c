@@ -0,0 +1,470 @@
+/**************************************************************
+ *
+ *                     ensemble.c
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Runs several machines loaded with the same program in 
+ *              lockstep. The machines share one program counter and their 
+ *              registers are stored structure of arrays, so CMOV, ADD, MUL, 
+ *              NAND and LV are done for every lane at once, with AVX2 when
+ *              the CPU has it. Every other instruction is done one lane 
+ *              at a time through handle_instruction. A lane that would 
+ *              leave the shared path is split off with its state written 
+ *              back, to be finished by the normal engine.
+ *
+ **************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <uarray.h>
+#include "assert.h"
+#include "ensemble.h"
+/* The AVX2 lanes are compiled on x86 and only used if the CPU has AVX2 */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ENSEMBLE_AVX2
+#include <immintrin.h>
+#endif
+
+/* Number of 32-bit lanes in an AVX2 register */
+#define AVX2_LANES 8
+
+#if ENSEMBLE_LANES % AVX2_LANES != 0
+#error "ENSEMBLE_LANES must be a multiple of AVX2_LANES"
+#endif
+
+/*   ensemble
+ *   The machines being run in lockstep
+ *    
+ *   Elements:
+ *      uint32_t registers[][]: the registers of every lane, indexed by 
+ *                              register and then by lane
+ *      machine_state *lanes:   the machine of each lane
+ *      bool active[]:          whether each lane is still in lockstep
+ *      int count:              the number of lanes in use
+ *      int program_counter:    the program counter shared by the lanes
+ *      bool avx2:              whether lockstep_alu can use AVX2
+ *  
+ */
+struct ensemble {
+        uint32_t registers[NUM_REGISTERS][ENSEMBLE_LANES];
+        machine_state *lanes;
+        bool active[ENSEMBLE_LANES];
+        int count;
+        int program_counter;
+        bool avx2;
+};
+
+typedef struct ensemble ensemble;
+
+/********** load_lane ********
+* Purpose:
+*      Copies the registers of a lane's machine into the ensemble
+* Inputs:
+*      ensemble *e: The ensemble
+*      int lane: The lane being loaded
+* Return/Effects:
+*      Fills in the lane's column of the register file
+* Expects:
+*      
+* Notes
+*      
+************************/
+static void load_lane(ensemble *e, int lane)
+{
+        for (int r = 0; r < NUM_REGISTERS; r++) {
+                e->registers[r][lane] = 
+                        *(uint32_t *) UArray_at(e->lanes[lane].registers, r);
+        }
+}
+
+
+/********** store_lane ********
+* Purpose:
+*      Copies the registers of a lane back into its machine
+* Inputs:
+*      ensemble *e: The ensemble
+*      int lane: The lane being stored
+*      int program_counter: The program counter the machine resumes at
+* Return/Effects:
+*      Updates the registers and program counter of the lane's machine
+* Expects:
+*      
+* Notes
+*      
+************************/
+static void store_lane(ensemble *e, int lane, int program_counter)
+{
+        for (int r = 0; r < NUM_REGISTERS; r++) {
+                *(uint32_t *) UArray_at(e->lanes[lane].registers, r) = 
+                                                        e->registers[r][lane];
+        }
+        e->lanes[lane].program_counter = program_counter;
+}
+
+
+/********** split_lane ********
+* Purpose:
+*      Takes a lane out of lockstep
+* Inputs:
+*      ensemble *e: The ensemble
+*      int lane: The lane leaving the ensemble
+*      int program_counter: The program counter the machine resumes at
+* Return/Effects:
+*      Writes the lane's state back to its machine and deactivates the lane
+* Expects:
+*      
+* Notes
+*      
+************************/
+static void split_lane(ensemble *e, int lane, int program_counter)
+{
+        store_lane(e, lane, program_counter);
+        e->active[lane] = false;
+}
+
+
+/********** count_retired ********
+* Purpose:
+*      Counts an instruction retired by every active lane
+* Inputs:
+*      ensemble *e: The ensemble
+*      um_opcode opcode: The instruction retired
+* Return/Effects:
+*      Updates the stats of each active lane's machine
+* Expects:
+*      
+* Notes
+*      
+************************/
+static void count_retired(ensemble *e, um_opcode opcode)
+{
+        for (int l = 0; l < e->count; l++) {
+                if (e->active[l]) {
+                        e->lanes[l].stats.opcodes[opcode]++;
+                }
+        }
+}
+
+
+/********** lockstep_alu_plain ********
+* Purpose:
+*      Performs CMOV, ADD, MUL, NAND or LV for every lane at once
+* Inputs:
+*      uint32_t *a, *b, *c: Registers A, B and C of every lane
+*      um_decoded ins: The instruction being performed
+* Return/Effects:
+*      Updates register A of every lane
+* Expects:
+*      
+* Notes
+*      Plain C loops, which the compiler may vectorize with whatever the 
+*      baseline instruction set allows.
+************************/
+static void lockstep_alu_plain(uint32_t *a, uint32_t *b, uint32_t *c, 
+                                                        um_decoded ins)
+{
+        switch (ins.opcode) {
+        case CMOV:
+                for (int l = 0; l < ENSEMBLE_LANES; l++) {
+                        uint32_t keep = -(uint32_t) (c[l] == 0);
+                        a[l] = (a[l] & keep) | (b[l] & ~keep);
+                }
+                break;
+        case ADD:
+                for (int l = 0; l < ENSEMBLE_LANES; l++) {
+                        a[l] = b[l] + c[l];
+                }
+                break;
+        case MUL:
+                for (int l = 0; l < ENSEMBLE_LANES; l++) {
+                        a[l] = b[l] * c[l];
+                }
+                break;
+        case NAND:
+                for (int l = 0; l < ENSEMBLE_LANES; l++) {
+                        a[l] = ~(b[l] & c[l]);
+                }
+                break;
+        default:
+                for (int l = 0; l < ENSEMBLE_LANES; l++) {
+                        a[l] = ins.value;
+                }
+                break;
+        }
+}
+
+
+#ifdef ENSEMBLE_AVX2
+/********** lockstep_alu_avx2 ********
+* Purpose:
+*      Performs CMOV, ADD, MUL, NAND or LV for every lane at once with AVX2
+* Inputs:
+*      uint32_t *a, *b, *c: Registers A, B and C of every lane
+*      um_decoded ins: The instruction being performed
+* Return/Effects:
+*      Updates register A of every lane
+* Expects:
+*      The CPU to support AVX2
+* Notes
+*      Only this function is compiled for AVX2, so the rest of the UM still
+*      runs on CPUs without it.
+************************/
+__attribute__((target("avx2")))
+static void lockstep_alu_avx2(uint32_t *a, uint32_t *b, uint32_t *c, 
+                                                        um_decoded ins)
+{
+        for (int l = 0; l < ENSEMBLE_LANES; l += AVX2_LANES) {
+                __m256i va = _mm256_loadu_si256((__m256i *) (a + l));
+                __m256i vb = _mm256_loadu_si256((__m256i *) (b + l));
+                __m256i vc = _mm256_loadu_si256((__m256i *) (c + l));
+                __m256i ones = _mm256_set1_epi32(-1);
+                switch (ins.opcode) {
+                case CMOV:
+                        /* Keep A in the lanes where C is zero */
+                        va = _mm256_blendv_epi8(vb, va, _mm256_cmpeq_epi32(
+                                        vc, _mm256_setzero_si256()));
+                        break;
+                case ADD:
+                        va = _mm256_add_epi32(vb, vc);
+                        break;
+                case MUL:
+                        va = _mm256_mullo_epi32(vb, vc);
+                        break;
+                case NAND:
+                        va = _mm256_xor_si256(_mm256_and_si256(vb, vc), ones);
+                        break;
+                default:
+                        va = _mm256_set1_epi32(ins.value);
+                        break;
+                }
+                _mm256_storeu_si256((__m256i *) (a + l), va);
+        }
+}
+#endif
+
+
+/********** lockstep_alu ********
+* Purpose:
+*      Performs CMOV, ADD, MUL, NAND or LV for every lane at once
+* Inputs:
+*      ensemble *e: The ensemble
+*      um_decoded ins: The instruction being performed
+* Return/Effects:
+*      Updates register A of every lane
+* Expects:
+*      
+* Notes
+*      Inactive lanes are computed as well. Their registers were written 
+*      back when they split, so the results are never read.
+************************/
+static void lockstep_alu(ensemble *e, um_decoded ins)
+{
+        uint32_t *a = e->registers[ins.A];
+        uint32_t *b = e->registers[ins.B];
+        uint32_t *c = e->registers[ins.C];
+#ifdef ENSEMBLE_AVX2
+        if (e->avx2) {
+                lockstep_alu_avx2(a, b, c, ins);
+                return;
+        }
+#endif
+        lockstep_alu_plain(a, b, c, ins);
+}
+
+
+/********** lockstep_division ********
+* Purpose:
+*      Performs DIV for every active lane
+* Inputs:
+*      ensemble *e: The ensemble
+*      um_decoded ins: The instruction being performed
+* Return/Effects:
+*      Updates register A of every active lane
+* Expects:
+*      No active lane to divide by zero
+* Notes
+*      There is no AVX2 integer division, and inactive lanes are skipped 
+*      so a stale zero there cannot fail.
+************************/
+static void lockstep_division(ensemble *e, um_decoded ins)
+{
+        for (int l = 0; l < e->count; l++) {
+                if (e->active[l]) {
+                        uint32_t divisor = e->registers[ins.C][l];
+                        assert(divisor != 0);
+                        e->registers[ins.A][l] = 
+                                        e->registers[ins.B][l] / divisor;
+                }
+        }
+}
+
+
+/********** lockstep_jump ********
+* Purpose:
+*      Performs LOADP for every active lane
+* Inputs:
+*      ensemble *e: The ensemble
+*      um_decoded ins: The instruction being performed
+*      int leader: The first active lane
+* Return/Effects:
+*      Moves the shared program counter when the leader jumps within the 
+*      zero segment. Lanes that jump anywhere else, and every lane when the 
+*      leader loads a new segment, are split off before the LOADP.
+* Expects:
+*      The shared program counter to be past the LOADP
+* Notes
+*      Split lanes perform the LOADP again in the normal engine, so loading 
+*      a segment only ever happens there. This keeps the zero segment of 
+*      every active lane identical.
+************************/
+static void lockstep_jump(ensemble *e, um_decoded ins, int leader)
+{
+        uint32_t segment = e->registers[ins.B][leader];
+        uint32_t target = e->registers[ins.C][leader];
+        for (int l = 0; l < e->count; l++) {
+                if (!e->active[l]) {
+                        continue;
+                }
+                if (segment != 0 || e->registers[ins.B][l] != 0 || 
+                                        e->registers[ins.C][l] != target) {
+                        split_lane(e, l, e->program_counter - 1);
+                }
+        }
+        if (segment == 0) {
+                machine_state *ms = &e->lanes[leader];
+                assert(target < (uint32_t) num_instructions(ms->memory));
+                count_retired(e, LOADP);
+                e->program_counter = target;
+        }
+}
+
+
+/********** scalar_step ********
+* Purpose:
+*      Performs an instruction one active lane at a time
+* Inputs:
+*      ensemble *e: The ensemble
+*      um_decoded ins: The instruction being performed
+* Return/Effects:
+*      Runs the instruction on each active lane's machine. A lane that 
+*      stores to its zero segment is split off, since its program may no 
+*      longer match the others.
+* Expects:
+*      The shared program counter to be past the instruction
+* Notes
+*      Used for memory, I/O and invalid instructions. The lane's registers 
+*      are copied to its machine and back around handle_instruction, so 
+*      stats, inline caches, I/O and fault reports behave just like the 
+*      normal engine.
+************************/
+static void scalar_step(ensemble *e, um_decoded ins)
+{
+        for (int l = 0; l < e->count; l++) {
+                if (!e->active[l]) {
+                        continue;
+                }
+                store_lane(e, l, e->program_counter);
+                memory_set_fault_counter(&e->lanes[l].program_counter);
+                bool drive = handle_instruction(ins, &e->lanes[l]);
+                assert(drive);
+                load_lane(e, l);
+                if (ins.opcode == SSTORE && e->registers[ins.A][l] == 0) {
+                        split_lane(e, l, e->program_counter);
+                }
+        }
+}
+
+
+/********** drive_ensemble ********
+* Purpose:
+*      Runs machines loaded with the same program in lockstep
+* Inputs:
+*      machine_state *lanes: The machines, one per lane
+*      bool *halted: Where to store whether each machine halted
+*      int count: The number of machines
+* Return/Effects:
+*      Runs the machines together until they halt or split off. Each 
+*      machine is left with its registers and program counter up to date, 
+*      and halted[] tells which ones still need to be run with drive_program.
+* Expects:
+*      Between 1 and ENSEMBLE_LANES machines, each with the same zero 
+*      segment and program counter
+* Notes
+*      The first active lane leads. Every active lane has the same zero 
+*      segment, so the leader's decoded program is used for all of them.
+************************/
+void drive_ensemble(machine_state *lanes, bool *halted, int count)
+{
+        assert(lanes != NULL);
+        assert(halted != NULL);
+        assert(count > 0 && count <= ENSEMBLE_LANES);
+        ensemble e;
+        e.lanes = lanes;
+        e.count = count;
+        e.program_counter = lanes[0].program_counter;
+#ifdef ENSEMBLE_AVX2
+        e.avx2 = __builtin_cpu_supports("avx2");
+#else
+        e.avx2 = false;
+#endif
+        for (int l = 0; l < ENSEMBLE_LANES; l++) {
+                e.active[l] = l < count;
+                for (int r = 0; r < NUM_REGISTERS; r++) {
+                        e.registers[r][l] = 0;
+                }
+        }
+        for (int l = 0; l < count; l++) {
+                assert(lanes[l].program_counter == e.program_counter);
+                halted[l] = false;
+                load_lane(&e, l);
+        }
+
+        int leader = 0;
+        while (leader < count) {
+                machine_state *lead = &lanes[leader];
+                /* Running off the end is left to drive_program to report */
+                if (e.program_counter >= num_instructions(lead->memory)) {
+                        for (int l = leader; l < count; l++) {
+                                if (e.active[l]) {
+                                        split_lane(&e, l, e.program_counter);
+                                }
+                        }
+                        break;
+                }
+                um_decoded ins = lead->program[e.program_counter];
+                e.program_counter++;
+                switch (ins.opcode) {
+                case CMOV: case ADD: case MUL: case NAND: case LV:
+                        lockstep_alu(&e, ins);
+                        count_retired(&e, ins.opcode);
+                        break;
+                case DIV:
+                        lockstep_division(&e, ins);
+                        count_retired(&e, ins.opcode);
+                        break;
+                case HALT:
+                        count_retired(&e, ins.opcode);
+                        for (int l = leader; l < count; l++) {
+                                if (e.active[l]) {
+                                        halted[l] = true;
+                                        split_lane(&e, l, e.program_counter);
+                                }
+                        }
+                        break;
+                case LOADP:
+                        lockstep_jump(&e, ins, leader);
+                        break;
+                default:
+                        scalar_step(&e, ins);
+                        break;
+                }
+                /* Hand the lead to the first lane still in lockstep */
+                while (leader < count && !e.active[leader]) {
+                        leader++;
+                }
+        }
+}
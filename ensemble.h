@@ -0,0 +1,23 @@
+/**************************************************************
+ *
+ *                     ensemble.h
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Interface of the ensemble module
+ *
+ **************************************************************/
+#ifndef ENSEMBLE_H_INCLUDED
+#define ENSEMBLE_H_INCLUDED
+
+#include <stdbool.h>
+#include "instructions.h"
+
+/* Number of machines run in lockstep, a multiple of the 8 AVX2 lanes */
+#define ENSEMBLE_LANES 8
+
+void drive_ensemble(machine_state *lanes, bool *halted, int count);
+
+#endif
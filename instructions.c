@@ -12,7 +12,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <bitpack.h>
+#include <string.h>
 #include "assert.h"
 #include "except.h"
 #include "instructions.h"
@@ -21,36 +21,41 @@ Except_T Invalid_Instruction = { "Instruction detected with invalid opcode" };
 
 /* The input value for EOF */
 #define INPUT_EOF ~0
+/* The first generation of a segment ID, which empty inline caches never 
+   match */
+#define INITIAL_GENERATION 1
+/* The inline cache site shared by SLOADs and SSTOREs stored into $m[0] */
+#define SHARED_SITE 0
 
 /********** handle_instruction ********
 * Purpose:
-*      Extract the operation code and call the corresponding instruction 
+*      Call the instruction that matches the operation code
 * Inputs:
-*	um_instruction word: The current instruction in the program
+*	um_decoded ins: The current instruction in the program, decoded
 *      machine_state *ms: The machine state struct that holds the UM ADT’s
 * Return/Effects:
-*      Frees the memory sequences and the register array
+*      Performs the instruction and returns false once the program halts
 * Expects:
 *      
 * Notes
 *      
 ************************/
-bool handle_instruction(um_instruction word, machine_state *ms)
+bool handle_instruction(um_decoded ins, machine_state *ms)
 {
         assert(ms != NULL);
-        /* Extract the values in the current instruction word*/
-        um_opcode opcode = Bitpack_getu(word, 4, 28);
-        um_register C = Bitpack_getu(word, 3, 0);
-        um_register B = Bitpack_getu(word, 3, 3);
-        um_register A = Bitpack_getu(word, 3, 6);
+        um_opcode opcode = ins.opcode;
+        um_register C = ins.C;
+        um_register B = ins.B;
+        um_register A = ins.A;
+        ms->stats.opcodes[opcode]++;
         
         /* Call the instruction with the corresponding op code */
         switch (opcode) {
                 case CMOV:      conditional_move(A, B, C, ms->registers);
                                 return true;
-                case SLOAD:     segmented_load(A, B, C, ms);
+                case SLOAD:     segmented_load(A, B, C, ins.value, ms);
                                 return true;
-                case SSTORE:    segmented_store(A, B, C, ms);
+                case SSTORE:    segmented_store(A, B, C, ins.value, ms);
                                 return true;
                 case ADD:       add(A, B, C, ms->registers);
                                 return true;
@@ -65,17 +70,13 @@ bool handle_instruction(um_instruction word, machine_state *ms)
                                 return true;
                 case UNMAP:     unmap_segment(C, ms);
                                 return true;
-                case OUT:       output(C, ms->registers);
+                case OUT:       output(C, ms);
                                 return true;
-                case IN:        input(C, ms->registers);
+                case IN:        input(C, ms);
                                 return true;
                 case LOADP:     load_program(B, C, ms);
                                 return true;
-
-                case LV:        
-                                A = Bitpack_getu(word, 3, 25);
-                                uint32_t val = Bitpack_getu(word, 25, 0);
-                                load_value(A, ms->registers, val);
+                case LV:        load_value(A, ms->registers, ins.value);
                                 return true;
         }
         /* Throw an exception when a invalid op code is passed in */
@@ -85,6 +86,192 @@ bool handle_instruction(um_instruction word, machine_state *ms)
 }
 
 
+/********** prepare_program ********
+* Purpose:
+*      Finds the decoded form of the zero segment
+* Inputs:
+*      machine_state *ms: The machine state struct that holds the UM ADT’s
+*      uint32_t source: The segment the zero segment was copied from, or 0
+* Return/Effects:
+*      Points the program at the decoded zero segment, taken from the code 
+*      cache when the same words were loaded recently and decoded otherwise,
+*      and makes sure there is an inline cache for each of its sites
+* Expects:
+*      The zero segment to be mapped
+* Notes
+*      Called whenever the zero segment is replaced. Counts a code cache hit 
+*      or miss in the stats. Caches left over from the previous program are 
+*      kept, since an entry is only used while its segment's generation 
+*      still matches. An overlay that has not been stored to since it was 
+*      last loaded still names its code cache entry, so it is found without
+*      hashing. Both segments are left naming the entry that was used.
+************************/
+void prepare_program(machine_state *ms, uint32_t source)
+{
+        assert(ms != NULL);
+        free(ms->private_program);
+        ms->private_program = NULL;
+        unsigned length = num_instructions(ms->memory);
+        unsigned bound;
+        bool guarded;
+        um_instruction *words = segment_base(ms->memory, 0, &bound, &guarded);
+        uint64_t serial = ms->segments[source].code_serial;
+        unsigned num_sites;
+        bool hit;
+        ms->program = code_cache_get(ms->code, words, length, &serial, 
+                                                        &num_sites, &hit);
+        ms->segments[source].code_serial = serial;
+        ms->segments[0].code_serial = serial;
+        if (hit) {
+                ms->stats.code_cache_hits++;
+        } else {
+                ms->stats.code_cache_misses++;
+        }
+        /* Site 0 is shared, so there is one more cache than sites */
+        if (num_sites + 1 > ms->num_caches) {
+                ms->caches = realloc(ms->caches, 
+                                (num_sites + 1) * sizeof(segment_cache));
+                assert(ms->caches != NULL);
+                memset(ms->caches + ms->num_caches, 0, 
+                        (num_sites + 1 - ms->num_caches) * 
+                                                sizeof(segment_cache));
+                ms->num_caches = num_sites + 1;
+        }
+}
+
+
+/********** store_program ********
+* Purpose:
+*      Keeps the decoded program in step with a store to the zero segment
+* Inputs:
+*      machine_state *ms: The machine state struct that holds the UM ADT’s
+*      uint32_t offset: The word of the zero segment that was stored to
+*      um_instruction word: The value that was stored
+* Return/Effects:
+*      Decodes the word into the program
+* Expects:
+*      offset to be in bounds of the zero segment
+* Notes
+*      Programs from the code cache are shared, so the first store takes a 
+*      private copy. The cached form still matches the words it was keyed by.
+*      A stored SLOAD or SSTORE keeps the site of the one it replaced, or 
+*      uses the shared site so the number of caches stays fixed.
+************************/
+void store_program(machine_state *ms, uint32_t offset, um_instruction word)
+{
+        assert(ms != NULL);
+        if (ms->private_program == NULL) {
+                unsigned length = num_instructions(ms->memory);
+                ms->private_program = malloc(length * sizeof(um_decoded));
+                assert(ms->private_program != NULL);
+                memcpy(ms->private_program, ms->program, 
+                                                length * sizeof(um_decoded));
+                ms->program = ms->private_program;
+        }
+        um_decoded *ins = &ms->private_program[offset];
+        unsigned site = SHARED_SITE;
+        if (ins->opcode == SLOAD || ins->opcode == SSTORE) {
+                site = ins->value;
+        }
+        decode_word(word, ins);
+        if (ins->opcode == SLOAD || ins->opcode == SSTORE) {
+                ins->value = site;
+        }
+}
+
+
+/********** track_segment ********
+* Purpose:
+*      Starts tracking the generation of a segment ID
+* Inputs:
+*      machine_state *ms: The machine state struct that holds the UM ADT’s
+*      uint32_t id: A segment ID that was just mapped
+* Return/Effects:
+*      Grows the segment table to cover id, giving new IDs their first 
+*      generation
+* Expects:
+*      
+* Notes
+*      A recycled ID keeps the generation its unmap left it with.
+************************/
+void track_segment(machine_state *ms, uint32_t id)
+{
+        assert(ms != NULL);
+        if (id < ms->num_segments) {
+                return;
+        }
+        unsigned length = ms->num_segments > 0 ? ms->num_segments : 1;
+        while (length <= id) {
+                length *= 2;
+        }
+        ms->segments = realloc(ms->segments, length * sizeof(segment_info));
+        assert(ms->segments != NULL);
+        for (unsigned i = ms->num_segments; i < length; i++) {
+                ms->segments[i].generation = INITIAL_GENERATION;
+                ms->segments[i].code_serial = 0;
+        }
+        ms->num_segments = length;
+}
+
+
+/********** fill_cache ********
+* Purpose:
+*      Refills an inline cache after a miss
+* Inputs:
+*      machine_state *ms: The machine state struct that holds the UM ADT’s
+*      segment_cache *cache: The cache that missed
+*      uint32_t id: The segment being accessed
+* Return/Effects:
+*      Points the cache at the current storage of segment id
+* Expects:
+*      Segment id to be mapped
+* Notes
+*      Kept out of cached_segment_at so the hit path stays small enough to 
+*      be inlined into handle_instruction along with the ALU instructions.
+************************/
+static void fill_cache(machine_state *ms, segment_cache *cache, uint32_t id)
+{
+        cache->base = segment_base(ms->memory, id, &cache->length, 
+                                                        &cache->guarded);
+        cache->id = id;
+        cache->generation = ms->segments[id].generation;
+}
+
+
+/********** cached_segment_at ********
+* Purpose:
+*      Grabs a word in memory through the inline cache of an instruction
+* Inputs:
+*      machine_state *ms: The machine state struct that holds the UM ADT’s
+*      unsigned site: The inline cache site of the instruction
+*      uint32_t id: The segment being accessed
+*      uint32_t offset: The word within that segment
+* Return/Effects:
+*      Returns a pointer to m[id][offset]. On a miss the cache of the 
+*      site is refilled from the memory module.
+* Expects:
+*      site to be below ms->num_caches
+* Notes
+*      A cache entry is stale once the storage of its segment has been 
+*      freed or replaced, which bumps the segment's generation. That only 
+*      happens in unmap_segment and load_program, so other segments keep 
+*      their caches. The generation is only read once the IDs match, and 
+*      a matching ID was mapped when the entry was filled, so it is always 
+*      in the segment table. Offsets into guarded segments are not 
+*      compared, the guard pages fault instead.
+************************/
+um_instruction *cached_segment_at(machine_state *ms, unsigned site, 
+                                        uint32_t id, uint32_t offset)
+{
+        segment_cache *cache = &ms->caches[site];
+        if (cache->id != id || 
+                        cache->generation != ms->segments[id].generation) {
+                fill_cache(ms, cache, id);
+        }
+        assert(cache->guarded || offset < cache->length);
+        return cache->base + offset;
+}
+
 
 /********** conditional_move ********
 * Purpose:
@@ -117,21 +304,22 @@ void conditional_move(um_register A, um_register B, um_register C,
 *      Loads a value from memory into a registers  
 * Inputs:
 *	um_register A, B, C : The registers that are being dealt with
+*      unsigned site: The inline cache site of the instruction
 *      machine_state *ms: The machine state struct that holds the UM ADT’s
 * Return/Effects:
 *      Loads the value at m[r[B]][r[C]] into register A
 * Expects:
 *      
 * Notes
-*      This function will interact with the memory module using the segment_at 
-*                                                               function.
+*      The segment is found through the inline cache of this instruction
+*      using cached_segment_at.
 ************************/
 void segmented_load(um_register A, um_register B, um_register C, 
-                                                        machine_state *ms) 
+                                        unsigned site, machine_state *ms) 
 {
         assert(ms != NULL);
         uint32_t *reg_A = UArray_at(ms->registers, A);
-        um_instruction val = *segment_at(ms->memory, 
+        um_instruction val = *cached_segment_at(ms, site, 
                                 *(uint32_t *) UArray_at(ms->registers, B), 
                                 *(uint32_t *) UArray_at(ms->registers, C));
         *reg_A = val;
@@ -143,24 +331,31 @@ void segmented_load(um_register A, um_register B, um_register C,
 *      Loads the value of a register into memory
 * Inputs:
 *	um_register A, B, C : The registers that are being dealt with. 
+*      unsigned site: The inline cache site of the instruction
 *      machine_state *ms: The machine state struct that holds the UM ADT’s
 * Return/Effects:
 *      Stores the value in register C at located m[r[B]][r[C]] in memory
 * Expects:
 *      
 * Notes
-*      This function will interact with the memory module using the 
-*      segment_at function.
+*      The segment is found through the inline cache of this instruction
+*      using cached_segment_at.
 ************************/
 void segmented_store(um_register A, um_register B, um_register C, 
-                                                        machine_state *ms) 
+                                        unsigned site, machine_state *ms) 
 {
         assert(ms != NULL);
+        uint32_t reg_A = *(uint32_t *) UArray_at(ms->registers, A);
+        uint32_t reg_B = *(uint32_t *) UArray_at(ms->registers, B);
         uint32_t reg_C = *(uint32_t *) UArray_at(ms->registers, C);
-        um_instruction *dst = segment_at(ms->memory, 
-                                *(uint32_t *) UArray_at(ms->registers, A), 
-                                *(uint32_t *) UArray_at(ms->registers, B));
+        um_instruction *dst = cached_segment_at(ms, site, reg_A, reg_B);
         *dst = reg_C;
+        /* The segment may no longer match its code cache entry */
+        ms->segments[reg_A].code_serial = 0;
+        /* Keep the decoded program in step with the zero segment */
+        if (reg_A == 0) {
+                store_program(ms, reg_B, reg_C);
+        }
 }
 
 
@@ -276,6 +471,9 @@ void map_segment(um_register B, um_register C, machine_state *ms)
         uint32_t reg_C = *(uint32_t *) UArray_at(ms->registers, C);
         uint32_t *reg_B = UArray_at(ms->registers, B);
         *reg_B = segment_new(ms->memory, ms->unmapped, reg_C);
+        track_segment(ms, *reg_B);
+        stats_map(&ms->stats, reg_C);
+        ms->stats.unmapped = Seq_length(ms->unmapped);
 }
 
 
@@ -300,7 +498,12 @@ void unmap_segment(um_register C, machine_state *ms)
         assert(ms != NULL);
         uint32_t reg_C = *(uint32_t *) UArray_at(ms->registers, C);
         assert(reg_C != 0);
+        stats_unmap(&ms->stats, segment_length(ms->memory, reg_C));
         segment_free(ms->memory, ms->unmapped, reg_C);
+        ms->stats.unmapped = Seq_length(ms->unmapped);
+        /* The ID may now be recycled, so its inline caches go stale */
+        ms->segments[reg_C].generation++;
+        ms->segments[reg_C].code_serial = 0;
 }
 
 
@@ -309,20 +512,24 @@ void unmap_segment(um_register C, machine_state *ms)
 *      Outputs a value to stdout
 * Inputs:
 *	um_register C : The register that is being dealt with
-*      UArray_T registers: The array of registers
+*      machine_state *ms: The machine state struct that holds the UM ADT’s
 * Return/Effects:
-*      Outputs the value in register C to stdout
+*      Outputs the value in register C to the machine's output
 * Expects:
 *      Only values from 0-255 are allowed
 * Notes
 *      
 ************************/
-void output(um_register C, UArray_T registers) 
+void output(um_register C, machine_state *ms) 
 {
-        assert(registers != NULL);
-        uint32_t reg_C = *(uint32_t *) UArray_at(registers, C);
+        assert(ms != NULL);
+        uint32_t reg_C = *(uint32_t *) UArray_at(ms->registers, C);
         assert(reg_C <= 255);
-        putchar(reg_C);
+        putc(reg_C, ms->out);
+        if (ms->session != NULL) {
+                session_putc(ms->session, reg_C);
+        }
+        ms->stats.bytes_out++;
 }
 
 
@@ -331,27 +538,31 @@ void output(um_register C, UArray_T registers)
 *      Waits for input on the I/O device 
 * Inputs:
 *	um_register C : The registers that are being dealt with
-*      UArray_T registers: The array of registers
+*      machine_state *ms: The machine state struct that holds the UM ADT’s
 * Return/Effects:
-*      Takes input from stdin and stores the value in register C
+*      Takes input from the machine's input and stores the value in 
+*      register C
 * Expects:
 *       Must be a value from 0 to 255. If the end of input has been signaled, 
 *	then $r[C] is loaded with a full 32-bit word in which every bit is 1.
 * Notes
 *      
 ************************/
-void input(um_register C, UArray_T registers) 
+void input(um_register C, machine_state *ms) 
 {
-        assert(registers != NULL);
-        int input = getc(stdin);
+        assert(ms != NULL);
+        /* A session records the input, or replays it in place of ms->in */
+        int input = ms->session != NULL ? session_getc(ms->session, ms->in) 
+                                        : getc(ms->in);
 
-        uint32_t *reg_C = UArray_at(registers, C);
+        uint32_t *reg_C = UArray_at(ms->registers, C);
         /* If the input is EOF then inert all 1s into register */
         if (input == EOF) {
                 *reg_C = INPUT_EOF;
                 return;
         }
         *reg_C = input;
+        ms->stats.bytes_in++;
 }
 
 
@@ -375,9 +586,18 @@ void load_program(um_register B, um_register C, machine_state *ms)
         assert(ms != NULL);
         uint32_t reg_B = *(uint32_t *) UArray_at(ms->registers, B);
         uint32_t reg_C = *(uint32_t *) UArray_at(ms->registers, C);
-        load_segment(ms->memory, ms->unmapped, reg_B);
+        /* Loading segment 0 is only a jump, so nothing is replaced */
+        if (reg_B != 0) {
+                stats_unmap(&ms->stats, num_instructions(ms->memory));
+                load_segment(ms->memory, ms->unmapped, reg_B);
+                stats_map(&ms->stats, num_instructions(ms->memory));
+                ms->stats.segment_loads++;
+                /* Caches of the old zero segment go stale */
+                ms->segments[0].generation++;
+                prepare_program(ms, reg_B);
+        }
         /* Make sure that the program counter is in bounds */
-        assert(reg_C < (uint32_t) UArray_length(Seq_get(ms->memory, 0)));
+        assert(reg_C < (uint32_t) num_instructions(ms->memory));
         /* Update the program counter */
         ms->program_counter = reg_C;
 }
@@ -19,6 +19,55 @@
 #include <seq.h>
 #include <uarray.h>
 #include "memory.h"
+#include "stats.h"
+#include "code.h"
+#include "session.h"
+
+/* Number of registers */
+#define NUM_REGISTERS 8
+
+/*   segment_cache
+ *   The inline cache of a single SLOAD or SSTORE instruction. It remembers 
+ *   the last segment that instruction used so repeat accesses skip the lookup.
+ *    
+ *   Elements:
+ *      uint64_t generation:  the generation of the segment when the entry 
+ *                            was filled
+ *      uint32_t id:          the segment ID that was looked up
+ *      unsigned length:      the number of words in that segment
+ *      bool guarded:         whether the guard pages bound that segment, 
+ *                            so length need not be checked
+ *      um_instruction *base: the first word of that segment
+ *  
+ */
+struct segment_cache {
+        uint64_t generation;
+        uint32_t id;
+        unsigned length;
+        bool guarded;
+        um_instruction *base;
+};
+
+typedef struct segment_cache segment_cache;
+
+/*   segment_info
+ *   What the machine tracks about a segment ID beyond the memory module
+ *    
+ *   Elements:
+ *      uint64_t generation:  bumped whenever the storage behind the ID is 
+ *                            freed or replaced, which makes every inline 
+ *                            cache filled for it stale
+ *      uint64_t code_serial: the code cache entry known to hold exactly the
+ *                            words of the segment, or 0 once the segment 
+ *                            has been stored to or unmapped
+ *  
+ */
+struct segment_info {
+        uint64_t generation;
+        uint64_t code_serial;
+};
+
+typedef struct segment_info segment_info;
 
 /*   machine_state
  *   This struct contains the infrastructure necessary for running the UM
@@ -28,6 +77,21 @@
  *      Seq_T unmapped:       identifies memory segments that have been unmapped
  *      UArray_T registers:   represents the 8 32-bit registers of the UM
  *      int program_counter:  identifies the current instruction
+ *      segment_cache *caches: one inline cache per SLOAD and SSTORE site of
+ *                            the program, plus the shared site 0
+ *      unsigned num_caches:  the number of entries in caches
+ *      segment_info *segments: the generation and code serial of each 
+ *                            segment ID
+ *      unsigned num_segments: the number of entries in segments
+ *      um_stats stats:       the always-on runtime counters
+ *      code_cache *code:     decoded forms of recently loaded programs
+ *      const um_decoded *program: the decoded zero segment
+ *      um_decoded *private_program: a copy of program made once the zero 
+ *                            segment is stored to, or NULL while program
+ *                            is still shared with the code cache
+ *      FILE *in:             where IN reads from
+ *      FILE *out:            where OUT writes to
+ *      session *session:     the I/O recording or replay, or NULL
  *  
  */
 struct machine_state {
@@ -35,6 +99,17 @@ struct machine_state {
         Seq_T unmapped;
         UArray_T registers;
         int program_counter;
+        segment_cache *caches;
+        unsigned num_caches;
+        segment_info *segments;
+        unsigned num_segments;
+        um_stats stats;
+        code_cache *code;
+        const um_decoded *program;
+        um_decoded *private_program;
+        FILE *in;
+        FILE *out;
+        session *session;
 };
 
 typedef struct machine_state machine_state;
@@ -46,21 +121,26 @@ typedef enum um_opcode {
         NAND, HALT, MAP, UNMAP, OUT, IN, LOADP, LV
 } um_opcode;
 
-bool handle_instruction(um_instruction word, machine_state *ms);
+bool handle_instruction(um_decoded ins, machine_state *ms);
+void track_segment(machine_state *ms, uint32_t id);
+void prepare_program(machine_state *ms, uint32_t source);
+void store_program(machine_state *ms, uint32_t offset, um_instruction word);
+um_instruction *cached_segment_at(machine_state *ms, unsigned site, 
+                                        uint32_t id, uint32_t offset);
 void conditional_move(um_register A, um_register B, um_register C, 
                                                         UArray_T registers);
 void segmented_load(um_register A, um_register B, um_register C, 
-                                                        machine_state *ms);
+                                        unsigned site, machine_state *ms);
 void segmented_store(um_register A, um_register B, um_register C, 
-                                                        machine_state *ms);
+                                        unsigned site, machine_state *ms);
 void add(um_register A, um_register B, um_register C, UArray_T registers);
 void multiply(um_register A, um_register B, um_register C, UArray_T registers);
 void division(um_register A, um_register B, um_register C, UArray_T registers);
 void nand(um_register A, um_register B, um_register C, UArray_T registers);
 void map_segment(um_register B, um_register C, machine_state *ms);
 void unmap_segment(um_register C, machine_state *ms);
-void output(um_register C, UArray_T registers);
-void input(um_register C, UArray_T registers);
+void output(um_register C, machine_state *ms);
+void input(um_register C, machine_state *ms);
 void load_program(um_register B, um_register C, machine_state *ms);
 void load_value(um_register A, UArray_T registers, uint32_t val);
 
@@ -15,11 +15,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <seq.h>
 #include <uarray.h>
 #include "assert.h"
+#include "memory.h"
 
-typedef uint32_t um_instruction;
 #define MAX_INDEX 4294967295
 
 /********** segment_new ********
@@ -144,6 +145,32 @@ void load_segment(Seq_T memory, Seq_T unmapped, unsigned index)
 }
 
 
+/********** segment_resize ********
+* Purpose:
+*      Changes the number of words held by a segment
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*      int index: The index of the segment being resized
+*      int num_words: The number of instructions this segment will hold
+* Return/Effects:
+*      Grows or shrinks the segment at the given index. Words up to the smaller
+*      of the old and new lengths keep their values.
+* Expects:
+*      The segment at index to be mapped
+* Notes
+*      Words added by growing the segment are not initialized, so this is only
+*      meant for filling a segment while the program is being loaded.
+************************/
+void segment_resize(Seq_T memory, unsigned index, unsigned num_words)
+{
+        assert(memory != NULL);
+        assert(index < (unsigned) Seq_length(memory));
+        UArray_T segment = Seq_get(memory, index);
+        assert(segment != NULL);
+        UArray_resize(segment, num_words);
+}
+
+
 /********** segment_at ********
 * Purpose:
 *      Grabs a specific word in memory 
@@ -171,6 +198,62 @@ um_instruction *segment_at(Seq_T memory, unsigned index, unsigned offset)
 }
 
 
+/********** segment_base ********
+* Purpose:
+*      Grabs the start of a segment along with its length
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*      int index: The index of the segment
+*      unsigned *length: Where the number of words in the segment is stored
+*      bool *guarded: Where whether the segment is guarded is stored
+* Return/Effects:
+*      Returns a pointer to the first word of the segment and stores its
+*      length in *length
+* Expects:
+*      The segment at index to be mapped
+* Notes
+*      The words of a segment are contiguous, and the pointer stays valid 
+*      until the segment is freed or replaced by load_segment. This backend
+*      has no guard pages, so *guarded is always false.
+************************/
+um_instruction *segment_base(Seq_T memory, unsigned index, unsigned *length,
+                                                        bool *guarded)
+{
+        assert(memory != NULL);
+        assert(length != NULL);
+        assert(guarded != NULL);
+        assert(index < (unsigned) Seq_length(memory));
+        UArray_T segment = Seq_get(memory, index);
+        assert(segment != NULL);
+        *length = UArray_length(segment);
+        *guarded = false;
+        return UArray_at(segment, 0);
+}
+
+
+/********** segment_length ********
+* Purpose:
+*      Determine the number of words in a segment
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*      int index: The index of the segment
+* Return/Effects:
+*      Returns the length of the segment at the given index
+* Expects:
+*      The segment at index to be mapped
+* Notes
+*      
+************************/
+unsigned segment_length(Seq_T memory, unsigned index)
+{
+        assert(memory != NULL);
+        assert(index < (unsigned) Seq_length(memory));
+        UArray_T segment = Seq_get(memory, index);
+        assert(segment != NULL);
+        return UArray_length(segment);
+}
+
+
 /********** free_memory ********
 * Purpose:
 *      Frees the entire memory unit 
@@ -221,4 +304,41 @@ int num_instructions(Seq_T memory)
         UArray_T program = Seq_get(memory, 0);
         assert(program != NULL);
         return UArray_length(program);
-}
\ No newline at end of file
+}
+
+
+/********** memory_install_fault_handler ********
+* Purpose:
+*      Turns out of bounds accesses into UM fault reports
+* Inputs:
+*      const int *program_counter: The program counter of the running UM
+* Return/Effects:
+*      Nothing, since segment_at checks every offset against the length of 
+*      its segment
+* Expects:
+*      
+* Notes
+*      Only the guard page backend in memory_guard.c needs a handler.
+************************/
+void memory_install_fault_handler(const int *program_counter)
+{
+        (void) program_counter;
+}
+
+
+/********** memory_set_fault_counter ********
+* Purpose:
+*      Changes which program counter fault reports use
+* Inputs:
+*      const int *program_counter: The program counter of the running UM
+* Return/Effects:
+*      Nothing, since this backend has no fault handler
+* Expects:
+*      
+* Notes
+*      
+************************/
+void memory_set_fault_counter(const int *program_counter)
+{
+        (void) program_counter;
+}
@@ -13,6 +13,7 @@
 #define MEMORY_H_INCLUDED
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <seq.h>
 #include <uarray.h>
 #include "stdint.h"
@@ -21,9 +22,15 @@ typedef uint32_t um_instruction;
 
 int segment_new(Seq_T memory, Seq_T unmapped, unsigned num_words);
 void segment_free(Seq_T memory, Seq_T unmapped, unsigned index);
-int load_segment(Seq_T memory, Seq_T unmapped, unsigned index);
+void load_segment(Seq_T memory, Seq_T unmapped, unsigned index);
+void segment_resize(Seq_T memory, unsigned index, unsigned num_words);
 um_instruction *segment_at(Seq_T memory, unsigned index, unsigned offset);
+um_instruction *segment_base(Seq_T memory, unsigned index, unsigned *length,
+                                                        bool *guarded);
+unsigned segment_length(Seq_T memory, unsigned index);
 void free_memory(Seq_T memory, Seq_T unmapped);
 int num_instructions(Seq_T memory);
+void memory_install_fault_handler(const int *program_counter);
+void memory_set_fault_counter(const int *program_counter);
 
 #endif
\ No newline at end of file
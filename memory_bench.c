@@ -0,0 +1,579 @@
+/**************************************************************
+ *
+ *                     memory_bench.c
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Microbenchmarks for the memory module. Each pattern drives 
+ *              the memory.h interface directly, with no UM program in 
+ *              between, and reports nanoseconds per operation, heap 
+ *              allocations per operation and peak memory. The benchmark 
+ *              links against whichever backend MEMORY selects, so 
+ *              implementations can be compared with the same patterns.
+ *
+ *              Usage: ./memory_bench [-n ops] [-w words] [-t segments] 
+ *                                    [pattern]...
+ *
+ **************************************************************/
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <seq.h>
+#include "assert.h"
+#include "memory.h"
+
+/* Default number of operations timed per pattern */
+#define DEFAULT_OPS 1000000
+/* Default number of words in a segment */
+#define DEFAULT_WORDS 1024
+/* Default number of live segments torn down at once */
+#define DEFAULT_TEARDOWN 1000000
+/* Number of live segments kept by the random churn pattern */
+#define CHURN_POOL 1024
+/* Number of segment sizes tried by the LOADP pattern */
+#define NUM_LOAD_SIZES 5
+/* Fewest operations timed for a single LOADP size */
+#define MIN_LOAD_OPS 10
+/* Number of benchmark patterns */
+#define NUM_PATTERNS 6
+
+/*   bench_config
+ *   The parameters shared by every pattern
+ *    
+ *   Elements:
+ *      unsigned ops:       operations timed per pattern
+ *      unsigned words:     words in each segment
+ *      unsigned teardown:  live segments freed by the teardown pattern
+ *  
+ */
+struct bench_config {
+        unsigned ops;
+        unsigned words;
+        unsigned teardown;
+};
+
+typedef struct bench_config bench_config;
+
+/*   bench_result
+ *   What was measured while a pattern ran
+ *    
+ *   Elements:
+ *      uint64_t start_ns:     the time the pattern started
+ *      uint64_t allocations:  the allocation count when it started
+ *  
+ */
+struct bench_result {
+        uint64_t start_ns;
+        uint64_t allocations;
+};
+
+typedef struct bench_result bench_result;
+
+/* Heap accounting, kept by the allocator wrappers below */
+static uint64_t allocations = 0;
+static size_t heap_bytes = 0;
+static size_t peak_heap_bytes = 0;
+/* Keeps the compiler from dropping loads that are never used */
+static volatile um_instruction sink;
+/* State of the xorshift generator, seeded so runs are repeatable */
+static uint64_t random_state = 88172645463325252ULL;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+
+/********** track ********
+* Purpose:
+*      Records a change in the size of the heap
+* Inputs:
+*      void *ptr: A block that was just allocated, or NULL
+* Return/Effects:
+*      Counts the allocation and updates the live and peak heap sizes
+* Expects:
+*      
+* Notes
+*      
+************************/
+static void track(void *ptr)
+{
+        if (ptr == NULL) {
+                return;
+        }
+        allocations++;
+        heap_bytes += malloc_usable_size(ptr);
+        if (heap_bytes > peak_heap_bytes) {
+                peak_heap_bytes = heap_bytes;
+        }
+}
+
+
+/********** malloc, calloc, realloc, free ********
+* Purpose:
+*      Wrap the glibc allocator so the benchmark can count allocations
+* Inputs:
+*      The same as the standard functions
+* Return/Effects:
+*      The same as the standard functions, and the heap accounting is kept 
+*      up to date
+* Expects:
+*      
+* Notes
+*      Defining them here replaces them for the Hanson libraries as well, 
+*      so every allocation the memory module makes is seen.
+************************/
+void *malloc(size_t size)
+{
+        void *ptr = __libc_malloc(size);
+        track(ptr);
+        return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+        void *ptr = __libc_calloc(count, size);
+        track(ptr);
+        return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+        if (ptr != NULL) {
+                heap_bytes -= malloc_usable_size(ptr);
+        }
+        void *moved = __libc_realloc(ptr, size);
+        track(moved);
+        return moved;
+}
+
+void free(void *ptr)
+{
+        if (ptr != NULL) {
+                heap_bytes -= malloc_usable_size(ptr);
+        }
+        __libc_free(ptr);
+}
+
+
+/********** posix_memalign, memalign, aligned_alloc, valloc, pvalloc ******
+* Purpose:
+*      Wrap the aligned allocators of glibc as well
+* Inputs:
+*      The same as the standard functions
+* Return/Effects:
+*      The same as the standard functions, and the heap accounting is kept 
+*      up to date
+* Expects:
+*      
+* Notes
+*      Blocks from these are released with the free above, so they have to
+*      be counted on the way in or heap_bytes would wrap below zero.
+************************/
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+        if (alignment % sizeof(void *) != 0 || 
+                                (alignment & (alignment - 1)) != 0) {
+                return EINVAL;
+        }
+        void *ptr = __libc_memalign(alignment, size);
+        if (ptr == NULL) {
+                return ENOMEM;
+        }
+        track(ptr);
+        *memptr = ptr;
+        return 0;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+        void *ptr = __libc_memalign(alignment, size);
+        track(ptr);
+        return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+        void *ptr = __libc_memalign(alignment, size);
+        track(ptr);
+        return ptr;
+}
+
+void *valloc(size_t size)
+{
+        void *ptr = __libc_valloc(size);
+        track(ptr);
+        return ptr;
+}
+
+void *pvalloc(size_t size)
+{
+        void *ptr = __libc_pvalloc(size);
+        track(ptr);
+        return ptr;
+}
+
+
+/********** next_random ********
+* Purpose:
+*      Produces the next pseudo-random number
+* Inputs:
+*      
+* Return/Effects:
+*      Returns a number from the xorshift64 sequence
+* Expects:
+*      
+* Notes
+*      Cheap enough that it barely shows up in the random patterns.
+************************/
+static uint64_t next_random(void)
+{
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 7;
+        random_state ^= random_state << 17;
+        return random_state;
+}
+
+
+/********** now_ns ********
+* Purpose:
+*      Reads the monotonic clock
+* Inputs:
+*      
+* Return/Effects:
+*      Returns the current time in nanoseconds
+* Expects:
+*      
+* Notes
+*      
+************************/
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/********** bench_start ********
+* Purpose:
+*      Starts measuring a pattern
+* Inputs:
+*      
+* Return/Effects:
+*      Returns the starting time and allocation count, and resets the peak 
+*      heap size to the current size
+* Expects:
+*      
+* Notes
+*      
+************************/
+static bench_result bench_start(void)
+{
+        bench_result start;
+        peak_heap_bytes = heap_bytes;
+        start.allocations = allocations;
+        start.start_ns = now_ns();
+        return start;
+}
+
+
+/********** bench_report ********
+* Purpose:
+*      Finishes measuring a pattern and prints its line
+* Inputs:
+*      const char *name: The name of the pattern
+*      bench_result start: What bench_start returned
+*      uint64_t ops: The number of operations done
+* Return/Effects:
+*      Prints the pattern name, ns/op, allocations/op, peak heap in KB and 
+*      the peak resident size of the process in KB
+* Expects:
+*      ops to be at least 1
+* Notes
+*      The resident size is the peak of the whole process so far, since 
+*      that is all the kernel reports. It is the figure to compare for the 
+*      guard page backend, whose segments are not on the heap.
+************************/
+static void bench_report(const char *name, bench_result start, uint64_t ops)
+{
+        uint64_t elapsed = now_ns() - start.start_ns;
+        uint64_t allocated = allocations - start.allocations;
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("%-16s %12.1f %12.3f %14zu %12ld\n", name, 
+                        (double) elapsed / ops, (double) allocated / ops, 
+                        peak_heap_bytes / 1024, usage.ru_maxrss);
+        fflush(stdout);
+}
+
+
+/********** memory_new ********
+* Purpose:
+*      Sets up memory the way the UM does before a program runs
+* Inputs:
+*      Seq_T *memory: Where the new memory sequence is stored
+*      Seq_T *unmapped: Where the new unmapped sequence is stored
+* Return/Effects:
+*      Creates both sequences and maps a one word zero segment
+* Expects:
+*      
+* Notes
+*      
+************************/
+static void memory_new(Seq_T *memory, Seq_T *unmapped)
+{
+        *memory = Seq_new(0);
+        *unmapped = Seq_new(0);
+        assert(*memory != NULL && *unmapped != NULL);
+        int zero = segment_new(*memory, *unmapped, 1);
+        assert(zero == 0);
+}
+
+
+/********** bench_churn_fixed ********
+* Purpose:
+*      Maps and immediately unmaps segments of a fixed size
+* Inputs:
+*      bench_config *config: The benchmark parameters
+* Return/Effects:
+*      Prints the result line. One operation is a map plus an unmap.
+* Expects:
+*      
+* Notes
+*      After the first round every map reuses the same unmapped ID.
+************************/
+static void bench_churn_fixed(bench_config *config)
+{
+        Seq_T memory, unmapped;
+        memory_new(&memory, &unmapped);
+        bench_result start = bench_start();
+        for (unsigned i = 0; i < config->ops; i++) {
+                int id = segment_new(memory, unmapped, config->words);
+                segment_free(memory, unmapped, id);
+        }
+        bench_report("churn_fixed", start, config->ops);
+        free_memory(memory, unmapped);
+}
+
+
+/********** bench_churn_random ********
+* Purpose:
+*      Maps and unmaps segments of random sizes with many segments live
+* Inputs:
+*      bench_config *config: The benchmark parameters
+* Return/Effects:
+*      Prints the result line. One operation unmaps a random live segment 
+*      and maps a new one of between 1 and twice the configured words.
+* Expects:
+*      
+* Notes
+*      The pool is filled before timing starts.
+************************/
+static void bench_churn_random(bench_config *config)
+{
+        Seq_T memory, unmapped;
+        memory_new(&memory, &unmapped);
+        unsigned pool[CHURN_POOL];
+        for (int i = 0; i < CHURN_POOL; i++) {
+                unsigned words = 1 + next_random() % (2 * config->words);
+                pool[i] = segment_new(memory, unmapped, words);
+        }
+        bench_result start = bench_start();
+        for (unsigned i = 0; i < config->ops; i++) {
+                unsigned slot = next_random() % CHURN_POOL;
+                unsigned words = 1 + next_random() % (2 * config->words);
+                segment_free(memory, unmapped, pool[slot]);
+                pool[slot] = segment_new(memory, unmapped, words);
+        }
+        bench_report("churn_random", start, config->ops);
+        free_memory(memory, unmapped);
+}
+
+
+/********** bench_at ********
+* Purpose:
+*      Reads words of one segment through segment_at
+* Inputs:
+*      bench_config *config: The benchmark parameters
+*      bool random: Whether offsets are random rather than sequential
+* Return/Effects:
+*      Prints the result line. One operation is one segment_at and a load.
+* Expects:
+*      
+* Notes
+*      
+************************/
+static void bench_at(bench_config *config, bool random)
+{
+        Seq_T memory, unmapped;
+        memory_new(&memory, &unmapped);
+        int id = segment_new(memory, unmapped, config->words);
+        bench_result start = bench_start();
+        unsigned offset = 0;
+        for (unsigned i = 0; i < config->ops; i++) {
+                if (random) {
+                        offset = next_random() % config->words;
+                } else if (++offset == config->words) {
+                        offset = 0;
+                }
+                sink = *segment_at(memory, id, offset);
+        }
+        bench_report(random ? "at_random" : "at_sequential", start, 
+                                                                config->ops);
+        free_memory(memory, unmapped);
+}
+
+
+/********** bench_loadp ********
+* Purpose:
+*      Loads segments into the zero segment, as LOADP does
+* Inputs:
+*      bench_config *config: The benchmark parameters
+* Return/Effects:
+*      Prints one result line per segment size, from 16 words to 1M words.
+*      One operation is one load_segment.
+* Expects:
+*      
+* Notes
+*      Larger sizes are timed with fewer operations so every size takes 
+*      about as long as copying ops words once.
+************************/
+static void bench_loadp(bench_config *config)
+{
+        static const unsigned sizes[NUM_LOAD_SIZES] = { 
+                16, 1024, 65536, 262144, 1048576 
+        };
+        static const char *names[NUM_LOAD_SIZES] = {
+                "loadp_16", "loadp_1k", "loadp_64k", "loadp_256k", "loadp_1m"
+        };
+        for (int s = 0; s < NUM_LOAD_SIZES; s++) {
+                Seq_T memory, unmapped;
+                memory_new(&memory, &unmapped);
+                int id = segment_new(memory, unmapped, sizes[s]);
+                unsigned ops = config->ops / sizes[s];
+                if (ops < MIN_LOAD_OPS) {
+                        ops = MIN_LOAD_OPS;
+                }
+                bench_result start = bench_start();
+                for (unsigned i = 0; i < ops; i++) {
+                        load_segment(memory, unmapped, id);
+                }
+                bench_report(names[s], start, ops);
+                free_memory(memory, unmapped);
+        }
+}
+
+
+/********** bench_teardown ********
+* Purpose:
+*      Frees memory with a large number of segments still mapped
+* Inputs:
+*      bench_config *config: The benchmark parameters
+* Return/Effects:
+*      Prints the result line. One operation is freeing one live segment.
+* Expects:
+*      
+* Notes
+*      Only free_memory is timed, not mapping the segments.
+************************/
+static void bench_teardown(bench_config *config)
+{
+        Seq_T memory, unmapped;
+        memory_new(&memory, &unmapped);
+        for (unsigned i = 0; i < config->teardown; i++) {
+                segment_new(memory, unmapped, 1);
+        }
+        bench_result start = bench_start();
+        free_memory(memory, unmapped);
+        bench_report("teardown", start, config->teardown + 1);
+}
+
+
+/********** run_pattern ********
+* Purpose:
+*      Runs a pattern by name
+* Inputs:
+*      const char *name: The name of the pattern
+*      bench_config *config: The benchmark parameters
+* Return/Effects:
+*      Returns false if there is no pattern with that name
+* Expects:
+*      
+* Notes
+*      
+************************/
+static bool run_pattern(const char *name, bench_config *config)
+{
+        if (strcmp(name, "churn_fixed") == 0) {
+                bench_churn_fixed(config);
+        } else if (strcmp(name, "churn_random") == 0) {
+                bench_churn_random(config);
+        } else if (strcmp(name, "at_sequential") == 0) {
+                bench_at(config, false);
+        } else if (strcmp(name, "at_random") == 0) {
+                bench_at(config, true);
+        } else if (strcmp(name, "loadp") == 0) {
+                bench_loadp(config);
+        } else if (strcmp(name, "teardown") == 0) {
+                bench_teardown(config);
+        } else {
+                return false;
+        }
+        return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+        static const char *patterns[NUM_PATTERNS] = {
+                "churn_fixed", "churn_random", "at_sequential", "at_random", 
+                "loadp", "teardown"
+        };
+        bench_config config = { DEFAULT_OPS, DEFAULT_WORDS, DEFAULT_TEARDOWN };
+        int first_pattern = argc;
+        for (int i = 1; i < argc; i++) {
+                if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+                        config.ops = strtoul(argv[++i], NULL, 10);
+                } else if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+                        config.words = strtoul(argv[++i], NULL, 10);
+                } else if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+                        config.teardown = strtoul(argv[++i], NULL, 10);
+                } else {
+                        first_pattern = i;
+                        break;
+                }
+        }
+        if (config.ops == 0 || config.words == 0) {
+                fprintf(stderr, "Invalid usage. Try: ./memory_bench "
+                        "[-n ops] [-w words] [-t segments] [pattern]...\n");
+                return EXIT_FAILURE;
+        }
+
+        printf("%-16s %12s %12s %14s %12s\n", "pattern", "ns/op", 
+                        "allocs/op", "peak_heap_kb", "maxrss_kb");
+        if (first_pattern == argc) {
+                for (int i = 0; i < NUM_PATTERNS; i++) {
+                        run_pattern(patterns[i], &config);
+                }
+                return EXIT_SUCCESS;
+        }
+        for (int i = first_pattern; i < argc; i++) {
+                if (!run_pattern(argv[i], &config)) {
+                        fprintf(stderr, "Unknown pattern: %s\n", argv[i]);
+                        return EXIT_FAILURE;
+                }
+        }
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,584 @@
+/**************************************************************
+ *
+ *                     memory_guard.c
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: An alternative implementation of the memory module that 
+ *              leaves bounds checking of large segments to the hardware.
+ *              Each large segment is placed at the very end of its own 
+ *              virtual reservation, followed by enough inaccessible guard 
+ *              pages that no 32-bit offset can reach past them. An out of 
+ *              bounds access traps with SIGSEGV, which is reported as a UM 
+ *              fault. Small segments, and large ones once the reservation 
+ *              budget is spent, are bounds checked like in memory.c.
+ *              Build it with "make MEMORY=memory_guard.o".
+ *
+ **************************************************************/
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <seq.h>
+#include "assert.h"
+#include "memory.h"
+
+#define MAX_INDEX 4294967295
+/* Segments with at least this many words get their own reservation */
+#define GUARD_MIN_WORDS 4096
+/* Bytes of guard pages after a segment, enough for any 32-bit offset */
+#define GUARD_BYTES ((size_t) 1 << 34)
+/* Most reservations live at once, which caps the address space used */
+#define GUARD_MAX_RESERVATIONS 1024
+/* Room for the text of a fault report */
+#define REPORT_LENGTH 128
+
+/*   segment
+ *   A segment of UM memory
+ *    
+ *   Elements:
+ *      um_instruction *words: the words of the segment
+ *      unsigned length:       the number of words in the segment
+ *      unsigned id:           the index of the segment in memory
+ *      void *reservation:     the start of the reservation holding the 
+ *                             words, or NULL if they were allocated normally
+ *      size_t reserved:       the number of bytes in the reservation
+ *      int slot:              the index of the segment in guarded[]
+ *  
+ */
+struct segment {
+        um_instruction *words;
+        unsigned length;
+        unsigned id;
+        void *reservation;
+        size_t reserved;
+        int slot;
+};
+
+typedef struct segment segment;
+
+/* The segments that currently own a reservation, for the fault handler */
+static segment *guarded[GUARD_MAX_RESERVATIONS];
+static volatile int num_guarded = 0;
+/* The program counter reported when a fault happens */
+static const int *fault_counter = NULL;
+
+/********** storage_new ********
+* Purpose:
+*      Allocates the words of a segment
+* Inputs:
+*      unsigned num_words: The number of words the segment holds
+* Return/Effects:
+*      Returns a new segment with every word set to 0
+* Expects:
+*      
+* Notes
+*      Large segments are right aligned against their guard pages, so 
+*      $m[id][length] is the first inaccessible word. Anonymous mappings 
+*      are already zeroed. A segment always has room for at least one word 
+*      so an empty segment still has a valid address.
+************************/
+static segment *storage_new(unsigned num_words)
+{
+        segment *seg = malloc(sizeof(*seg));
+        assert(seg != NULL);
+        seg->length = num_words;
+        seg->id = 0;
+        seg->reservation = NULL;
+        seg->reserved = 0;
+        seg->slot = -1;
+        if (num_words >= GUARD_MIN_WORDS && 
+                                num_guarded < GUARD_MAX_RESERVATIONS) {
+                size_t page = sysconf(_SC_PAGESIZE);
+                size_t bytes = (size_t) num_words * sizeof(um_instruction);
+                size_t data = (bytes + page - 1) / page * page;
+                void *map = mmap(NULL, data + GUARD_BYTES, PROT_NONE, 
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                if (map != MAP_FAILED) {
+                        int ret = mprotect(map, data, PROT_READ | PROT_WRITE);
+                        assert(ret == 0);
+                        seg->reservation = map;
+                        seg->reserved = data + GUARD_BYTES;
+                        seg->words = (um_instruction *) 
+                                        ((char *) map + data - bytes);
+                        seg->slot = num_guarded;
+                        guarded[seg->slot] = seg;
+                        num_guarded++;
+                        return seg;
+                }
+        }
+        /* Fall back to a bounds checked segment */
+        seg->words = calloc(num_words > 0 ? num_words : 1, 
+                                                sizeof(um_instruction));
+        assert(seg->words != NULL);
+        return seg;
+}
+
+
+/********** storage_free ********
+* Purpose:
+*      Frees a segment and its words
+* Inputs:
+*      segment *seg: The segment being freed
+* Return/Effects:
+*      Releases the reservation or allocation holding the words
+* Expects:
+*      
+* Notes
+*      The last guarded segment takes the freed slot so guarded[] stays 
+*      packed.
+************************/
+static void storage_free(segment *seg)
+{
+        assert(seg != NULL);
+        if (seg->reservation != NULL) {
+                num_guarded--;
+                guarded[seg->slot] = guarded[num_guarded];
+                guarded[seg->slot]->slot = seg->slot;
+                int ret = munmap(seg->reservation, seg->reserved);
+                assert(ret == 0);
+        } else {
+                free(seg->words);
+        }
+        free(seg);
+}
+
+
+/********** segment_new ********
+* Purpose:
+*      Initializes a new segment into memory
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*	Seq_T unmapped: The sequence storing the currently unmapped segment 
+                                                                        indices
+*      int num_words: The number of instructions this segment will hold
+* Return/Effects:
+*      Creates a new segment with the number of instructions equal to register 
+*       C and returns the memory index this segment was stored.
+* Expects:
+*      
+* Notes
+*      
+************************/
+int segment_new(Seq_T memory, Seq_T unmapped, unsigned num_words)
+{
+        assert(memory != NULL);
+        assert(unmapped != NULL);
+        assert(num_words > 0);
+
+        segment *seg = storage_new(num_words);
+        /* Insert segment in the back if there are no unmapped segments */
+        if (Seq_length(unmapped) == 0) {
+                Seq_addhi(memory, seg);
+                /* checks for resource exhaustion */
+                assert((Seq_length(memory) - 1) <= MAX_INDEX);
+                seg->id = Seq_length(memory) - 1;
+                return seg->id;
+        } else { /* If unmapped segments then reuse that segment index */
+                int *top = (int *) Seq_get(unmapped, 0);
+                int index = *top;
+                /* Remove that segment ID from the unmapped sequence */
+                Seq_remlo(unmapped);
+                free(top);
+                /* Insert the new segment into the available spot */
+                Seq_put(memory, index, seg);
+                /* checks for resource exhaustion */
+                assert((Seq_length(memory) - 1) <= MAX_INDEX);
+                seg->id = index;
+                return index;
+        }
+}
+
+
+/********** segment_free ********
+* Purpose:
+*      Frees the segment 
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*	Seq_T unmapped: The sequence storing the currently unmapped segment 
+                                                                indices
+*       int index: The index of the segment being freed
+* Return/Effects:
+*      Frees the segment at a specified index and inserts the segment index 
+*      into the unmapped sequence.
+* Expects:
+*      
+* Notes
+*      
+************************/
+void segment_free(Seq_T memory, Seq_T unmapped, unsigned index) 
+{
+        assert(memory != NULL);
+        assert(unmapped != NULL);
+        assert(index < (unsigned) Seq_length(memory));
+        segment *remove = Seq_get(memory, index);
+        assert(remove != NULL);
+        storage_free(remove);
+        Seq_put(memory, index, NULL);
+        /* Insert the index of the freed segment into the unmapped sequence */
+        int *free_index = malloc(sizeof(int));
+        assert(free_index != NULL);
+        *free_index = index;
+        Seq_addhi(unmapped, free_index);
+}
+
+
+/********** load_segment ********
+* Purpose:
+*      Loads a specific segment into the 0 slot 
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*	Seq_T unmapped: The sequence storing the currently unmapped segment 
+                                                                indices
+*      int index: The index of the segment being loaded
+* Return/Effects:
+*      Duplicates the specified segment and places it into the 0 segment slot, 
+*	abandoning the old 0 segment. 
+* Expects:
+*      
+* Notes
+*      
+************************/
+void load_segment(Seq_T memory, Seq_T unmapped, unsigned index) 
+{
+        assert(memory != NULL);
+        assert(unmapped != NULL);
+        /* Do not load any segment if the index is the zero segment */
+        if (index == 0) {
+                return;
+        }
+        assert(index < (unsigned) Seq_length(memory));
+
+        /* Free the current zero segment */
+        segment *zero_seg = Seq_get(memory, 0);
+        assert(zero_seg != NULL);
+        storage_free(zero_seg);
+
+        /* Duplicate the segment that is being loaded */
+        segment *seg = Seq_get(memory, index);
+        assert(seg != NULL);
+        segment *copy = storage_new(seg->length);
+        memcpy(copy->words, seg->words, 
+                                (size_t) seg->length * sizeof(um_instruction));
+        /* Load the duplicated segment into the zero segment slot */
+        Seq_put(memory, 0, copy);
+}
+
+
+/********** segment_resize ********
+* Purpose:
+*      Changes the number of words held by a segment
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*      int index: The index of the segment being resized
+*      int num_words: The number of instructions this segment will hold
+* Return/Effects:
+*      Grows or shrinks the segment at the given index. Words up to the smaller
+*      of the old and new lengths keep their values.
+* Expects:
+*      The segment at index to be mapped
+* Notes
+*      The words move to new storage sized for the new length, so the guard 
+*      pages stay right after the last word.
+************************/
+void segment_resize(Seq_T memory, unsigned index, unsigned num_words)
+{
+        assert(memory != NULL);
+        assert(index < (unsigned) Seq_length(memory));
+        segment *seg = Seq_get(memory, index);
+        assert(seg != NULL);
+        segment *resized = storage_new(num_words);
+        unsigned kept = seg->length < num_words ? seg->length : num_words;
+        memcpy(resized->words, seg->words, 
+                                (size_t) kept * sizeof(um_instruction));
+        resized->id = index;
+        storage_free(seg);
+        Seq_put(memory, index, resized);
+}
+
+
+/********** segment_at ********
+* Purpose:
+*      Grabs a specific word in memory 
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*      int index: The index of the segment
+*      int offset: The word within the segment
+* Return/Effects:
+*      Returns a pointer to the word at a given index and offset 
+* Expects:
+*      
+* Notes
+*      Guarded segments are not compared against their length. An out of 
+*      bounds offset lands in the guard pages and traps when it is used.
+************************/
+um_instruction *segment_at(Seq_T memory, unsigned index, unsigned offset) 
+{
+        assert(memory != NULL);
+        assert(index < (unsigned) Seq_length(memory));
+        segment *seg = Seq_get(memory, index);
+        assert(seg != NULL);
+        assert(seg->reservation != NULL || offset < seg->length);
+        return seg->words + offset;
+}
+
+
+/********** segment_base ********
+* Purpose:
+*      Grabs the start of a segment along with its length
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*      int index: The index of the segment
+*      unsigned *length: Where the number of words in the segment is stored
+*      bool *guarded: Where whether the segment is guarded is stored
+* Return/Effects:
+*      Returns a pointer to the first word of the segment, stores its 
+*      length in *length and stores in *guarded whether it sits in front 
+*      of guard pages
+* Expects:
+*      The segment at index to be mapped
+* Notes
+*      Callers may skip their own bounds check on guarded segments, since 
+*      the guard pages cover every 32-bit offset past the end.
+************************/
+um_instruction *segment_base(Seq_T memory, unsigned index, unsigned *length,
+                                                        bool *guarded)
+{
+        assert(memory != NULL);
+        assert(length != NULL);
+        assert(guarded != NULL);
+        assert(index < (unsigned) Seq_length(memory));
+        segment *seg = Seq_get(memory, index);
+        assert(seg != NULL);
+        *length = seg->length;
+        *guarded = seg->reservation != NULL;
+        return seg->words;
+}
+
+
+/********** segment_length ********
+* Purpose:
+*      Determine the number of words in a segment
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*      int index: The index of the segment
+* Return/Effects:
+*      Returns the length of the segment at the given index
+* Expects:
+*      The segment at index to be mapped
+* Notes
+*      
+************************/
+unsigned segment_length(Seq_T memory, unsigned index)
+{
+        assert(memory != NULL);
+        assert(index < (unsigned) Seq_length(memory));
+        segment *seg = Seq_get(memory, index);
+        assert(seg != NULL);
+        return seg->length;
+}
+
+
+/********** free_memory ********
+* Purpose:
+*      Frees the entire memory unit 
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+*	Seq_T unmapped: The sequence storing the currently unmapped segment 
+*                       indices
+* Return/Effects:
+*      Frees each segment in memory 
+* Expects:
+*      
+* Notes
+*      
+************************/
+void free_memory(Seq_T memory, Seq_T unmapped) 
+{
+        assert(memory != NULL);
+        assert(unmapped != NULL);
+        /* Free the contents of main memory  */
+        for (int i = 0; i < Seq_length(memory); i++) {
+                segment *remove = Seq_get(memory, i);
+                if (remove != NULL) {
+                        storage_free(remove);
+                }
+        }
+        Seq_free(&memory);
+        /* Free the contents of the unmapped memory sequence */
+        for (int j = 0; j < Seq_length(unmapped); j++) {
+                int *index = Seq_get(unmapped, j);
+                free(index);
+        }
+        Seq_free(&unmapped);
+}
+
+
+/********** num_instructions ********
+* Purpose:
+*      Determine the number of instructions in the zero segment
+* Inputs:
+*	Seq_T memory: The sequence storing all the segments
+* Return/Effects:
+*      Returns the length of the zero segment in main memory 
+* Expects:
+*      The zero segment not to be null
+* Notes
+*      
+************************/
+int num_instructions(Seq_T memory)
+{
+        assert(memory != NULL);
+        segment *program = Seq_get(memory, 0);
+        assert(program != NULL);
+        return program->length;
+}
+
+
+/********** append_number ********
+* Purpose:
+*      Writes a number in decimal without using stdio
+* Inputs:
+*      char *buf: Where the digits are written
+*      uint64_t n: The number to write
+* Return/Effects:
+*      Returns a pointer just past the last digit
+* Expects:
+*      Room for 20 digits
+* Notes
+*      Used by the fault handler, where printf is not safe to call.
+************************/
+static char *append_number(char *buf, uint64_t n)
+{
+        char digits[20];
+        int count = 0;
+        do {
+                digits[count++] = '0' + n % 10;
+                n /= 10;
+        } while (n > 0);
+        while (count > 0) {
+                *buf++ = digits[--count];
+        }
+        return buf;
+}
+
+
+/********** append_text ********
+* Purpose:
+*      Copies a string without using stdio
+* Inputs:
+*      char *buf: Where the text is written
+*      const char *text: The text to write
+* Return/Effects:
+*      Returns a pointer just past the last character
+* Expects:
+*      
+* Notes
+*      
+************************/
+static char *append_text(char *buf, const char *text)
+{
+        while (*text != '\0') {
+                *buf++ = *text++;
+        }
+        return buf;
+}
+
+
+/********** report_fault ********
+* Purpose:
+*      The SIGSEGV handler
+* Inputs:
+*      int signum: The signal that was caught
+*      siginfo_t *info: Holds the address that faulted
+*      void *context: Unused
+* Return/Effects:
+*      If the address is in the guard pages of a segment, reports the 
+*      program counter, segment and offset of the access and exits. 
+*      Otherwise the default action is restored so the fault crashes as usual.
+* Expects:
+*      
+* Notes
+*      The program counter has already moved past the faulting instruction.
+************************/
+static void report_fault(int signum, siginfo_t *info, void *context)
+{
+        (void) context;
+        char *addr = info->si_addr;
+        for (int i = 0; i < num_guarded; i++) {
+                segment *seg = guarded[i];
+                char *start = seg->reservation;
+                if (addr < (char *) seg->words || 
+                                        addr >= start + seg->reserved) {
+                        continue;
+                }
+                uint64_t offset = (addr - (char *) seg->words) / 
+                                                sizeof(um_instruction);
+                char report[REPORT_LENGTH];
+                char *end = append_text(report, "UM fault: pc ");
+                end = append_number(end, fault_counter != NULL ? 
+                                                *fault_counter - 1 : 0);
+                end = append_text(end, ", segment ");
+                end = append_number(end, seg->id);
+                end = append_text(end, ", offset ");
+                end = append_number(end, offset);
+                end = append_text(end, " is out of bounds (length ");
+                end = append_number(end, seg->length);
+                end = append_text(end, ")\n");
+                ssize_t ret = write(STDERR_FILENO, report, end - report);
+                (void) ret;
+                _exit(EXIT_FAILURE);
+        }
+        signal(signum, SIG_DFL);
+}
+
+
+/********** memory_install_fault_handler ********
+* Purpose:
+*      Turns accesses that hit the guard pages into UM fault reports
+* Inputs:
+*      const int *program_counter: The program counter of the running UM
+* Return/Effects:
+*      Installs the SIGSEGV handler
+* Expects:
+*      
+* Notes
+*      
+************************/
+void memory_install_fault_handler(const int *program_counter)
+{
+        fault_counter = program_counter;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = report_fault;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_SIGINFO;
+        int ret = sigaction(SIGSEGV, &action, NULL);
+        assert(ret == 0);
+}
+
+
+/********** memory_set_fault_counter ********
+* Purpose:
+*      Changes which program counter fault reports use
+* Inputs:
+*      const int *program_counter: The program counter of the running UM
+* Return/Effects:
+*      Fault reports name the instruction before *program_counter
+* Expects:
+*      memory_install_fault_handler to have been called
+* Notes
+*      Cheap enough to call before every instruction, for when several 
+*      machines take turns running.
+************************/
+void memory_set_fault_counter(const int *program_counter)
+{
+        fault_counter = program_counter;
+}
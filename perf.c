@@ -0,0 +1,249 @@
+/**************************************************************
+ *
+ *                     perf.c
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Reads the hardware performance counters of the CPU through 
+ *              perf_event_open while the UM runs, and reports them per UM 
+ *              instruction retired. The report uses the same "name value" 
+ *              lines as the stats module so both can be stored together.
+ *
+ **************************************************************/
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "assert.h"
+#include "perf.h"
+
+/* Builds the config of a hardware cache read miss event */
+#define CACHE_READ_MISS(cache) ((cache) | \
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* The format of a read, with the times used to scale a multiplexed count */
+#define READ_FORMAT (PERF_FORMAT_TOTAL_TIME_ENABLED | \
+                PERF_FORMAT_TOTAL_TIME_RUNNING)
+
+/* Number of opcode classes in the report */
+#define NUM_CLASSES 4
+
+static const struct {
+        const char *name;
+        uint32_t type;
+        uint64_t config;
+} events[NUM_PERF_EVENTS] = {
+        { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { "l1d_misses", PERF_TYPE_HW_CACHE, 
+                                CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+        { "llc_misses", PERF_TYPE_HW_CACHE, 
+                                CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+        { "dtlb_misses", PERF_TYPE_HW_CACHE, 
+                                CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) }
+};
+
+/* The class of each opcode, in the order of um_opcode */
+static const int opcode_classes[NUM_OPCODES] = {
+        0, 1, 1, 0, 0, 0, 0, 2, 1, 1, 3, 3, 2, 0, 0, 0
+};
+
+static const char *class_names[NUM_CLASSES] = { 
+        "alu", "memory", "control", "io" 
+};
+
+/********** perf_open ********
+* Purpose:
+*      Opens a counter for each hardware event
+* Inputs:
+*      perf_counters *pc: The counters being opened
+* Return/Effects:
+*      Opens every event that the CPU and kernel allow. The counters start 
+*      out disabled.
+* Expects:
+*      
+* Notes
+*      Events are opened one at a time rather than as a group, so one 
+*      unsupported event does not hide the rest. Only user space is counted.
+*      When there are more events than hardware counters the kernel 
+*      multiplexes them, so each read also returns how long the event was 
+*      enabled and how long it was really counting.
+************************/
+void perf_open(perf_counters *pc)
+{
+        assert(pc != NULL);
+        for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+                struct perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = events[i].type;
+                attr.config = events[i].config;
+                attr.disabled = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = READ_FORMAT;
+                pc->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+                pc->values[i] = 0;
+                pc->running[i] = 0.0;
+        }
+}
+
+
+/********** perf_start ********
+* Purpose:
+*      Starts counting
+* Inputs:
+*      perf_counters *pc: The open counters
+* Return/Effects:
+*      Resets and enables every open counter
+* Expects:
+*      
+* Notes
+*      
+************************/
+void perf_start(perf_counters *pc)
+{
+        assert(pc != NULL);
+        for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+                if (pc->fds[i] >= 0) {
+                        ioctl(pc->fds[i], PERF_EVENT_IOC_RESET, 0);
+                        ioctl(pc->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+                }
+        }
+}
+
+
+/********** perf_stop ********
+* Purpose:
+*      Stops counting and reads the counts
+* Inputs:
+*      perf_counters *pc: The running counters
+* Return/Effects:
+*      Disables every open counter and stores its scaled count in values 
+*      and the fraction of the run it counted for in running
+* Expects:
+*      perf_start to have been called
+* Notes
+*      A counter that cannot be read is treated as unavailable. A count 
+*      taken for only part of the run is scaled by enabled / running time, 
+*      which assumes the rest of the run behaved the same.
+************************/
+void perf_stop(perf_counters *pc)
+{
+        assert(pc != NULL);
+        for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+                if (pc->fds[i] < 0) {
+                        continue;
+                }
+                ioctl(pc->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                /* The count, then the time enabled and time running */
+                uint64_t data[3];
+                ssize_t n = read(pc->fds[i], data, sizeof(data));
+                if (n != sizeof(data)) {
+                        close(pc->fds[i]);
+                        pc->fds[i] = -1;
+                        continue;
+                }
+                if (data[2] == 0) {
+                        pc->values[i] = 0;
+                        pc->running[i] = 0.0;
+                } else if (data[2] < data[1]) {
+                        pc->running[i] = (double) data[2] / data[1];
+                        pc->values[i] = (double) data[0] / pc->running[i];
+                } else {
+                        pc->values[i] = data[0];
+                        pc->running[i] = 1.0;
+                }
+        }
+}
+
+
+/********** perf_report ********
+* Purpose:
+*      Writes out the hardware counts
+* Inputs:
+*      FILE *fp: Where the report is written
+*      perf_counters *pc: The stopped counters
+*      um_stats *stats: The counters of the UM that was measured
+* Return/Effects:
+*      Writes the total, the per UM instruction value and the running 
+*      fraction of each available event, the instructions retired by each 
+*      opcode class, and a blank line
+* Expects:
+*      perf_stop to have been called
+* Notes
+*      Unavailable events are reported with a value of "unavailable", and 
+*      events the kernel never got onto a counter with "not_counted", so 
+*      missing numbers are not mistaken for zero. A running fraction below 
+*      1 means the total is an estimate.
+************************/
+void perf_report(FILE *fp, perf_counters *pc, um_stats *stats)
+{
+        assert(fp != NULL);
+        assert(pc != NULL);
+        assert(stats != NULL);
+        uint64_t retired = 0;
+        uint64_t classes[NUM_CLASSES] = { 0 };
+        for (int i = 0; i < NUM_OPCODES; i++) {
+                retired += stats->opcodes[i];
+                classes[opcode_classes[i]] += stats->opcodes[i];
+        }
+        fprintf(fp, "perf.um_instructions %" PRIu64 "\n", retired);
+        for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+                if (pc->fds[i] < 0) {
+                        fprintf(fp, "perf.%s unavailable\n", events[i].name);
+                        continue;
+                }
+                if (pc->running[i] == 0.0) {
+                        fprintf(fp, "perf.%s not_counted\n", events[i].name);
+                        continue;
+                }
+                fprintf(fp, "perf.%s %" PRIu64 "\n", events[i].name, 
+                                                        pc->values[i]);
+                fprintf(fp, "perf.%s_per_um_instruction %.4f\n", 
+                        events[i].name, retired == 0 ? 0.0 : 
+                                (double) pc->values[i] / (double) retired);
+                fprintf(fp, "perf.%s_running_fraction %.4f\n", 
+                                        events[i].name, pc->running[i]);
+        }
+        for (int i = 0; i < NUM_CLASSES; i++) {
+                fprintf(fp, "perf.class.%s %" PRIu64 "\n", class_names[i], 
+                                                                classes[i]);
+        }
+        fprintf(fp, "\n");
+        fflush(fp);
+}
+
+
+/********** perf_close ********
+* Purpose:
+*      Closes the counters
+* Inputs:
+*      perf_counters *pc: The open counters
+* Return/Effects:
+*      Closes the file descriptor of every open counter
+* Expects:
+*      
+* Notes
+*      
+************************/
+void perf_close(perf_counters *pc)
+{
+        assert(pc != NULL);
+        for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+                if (pc->fds[i] >= 0) {
+                        close(pc->fds[i]);
+                        pc->fds[i] = -1;
+                }
+        }
+}
@@ -0,0 +1,48 @@
+/**************************************************************
+ *
+ *                     perf.h
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Interface of the hardware performance counter module
+ *
+ **************************************************************/
+#ifndef PERF_H_INCLUDED
+#define PERF_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include "stats.h"
+
+/* Number of hardware events that are counted */
+#define NUM_PERF_EVENTS 6
+
+/*   perf_counters
+ *   The hardware counters opened around a run of the UM
+ *    
+ *   Elements:
+ *      int fds[]:         the perf_event_open file descriptor of each 
+ *                         event, or -1 if the event is not available
+ *      uint64_t values[]: the count of each event once stopped, scaled
+ *                         up to the whole run if it was multiplexed
+ *      double running[]:  the fraction of the run each event was actually 
+ *                         on the hardware for
+ *  
+ */
+struct perf_counters {
+        int fds[NUM_PERF_EVENTS];
+        uint64_t values[NUM_PERF_EVENTS];
+        double running[NUM_PERF_EVENTS];
+};
+
+typedef struct perf_counters perf_counters;
+
+void perf_open(perf_counters *pc);
+void perf_start(perf_counters *pc);
+void perf_stop(perf_counters *pc);
+void perf_report(FILE *fp, perf_counters *pc, um_stats *stats);
+void perf_close(perf_counters *pc);
+
+#endif
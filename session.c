@@ -0,0 +1,388 @@
+/**************************************************************
+ *
+ *                     session.c
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Records the input of a UM run along with a checksum of its 
+ *              output, and replays that input later so the run can be 
+ *              repeated exactly. A recording is laid out as
+ *
+ *                  magic      "UMREC01\n"
+ *                  input      every byte IN read, in order
+ *                  marks      mark_count pairs of 64-bit (input offset, 
+ *                             nanoseconds since the start of the run)
+ *                  trailer    64-bit input length, mark count, output 
+ *                             length and output checksum, then "UMRECEND"
+ *
+ *              Numbers are in the byte order of the recording machine. A 
+ *              mark is taken whenever IN follows OUT, which is when an 
+ *              interactive run waits for its next input. Replays map the 
+ *              file and read input straight from the mapping.
+ *
+ *              Input is written out as soon as it is read, while the marks 
+ *              and trailer are only written when the run halts. A run that 
+ *              is killed leaves just the magic and its input, which still 
+ *              replays but without an output check.
+ *
+ **************************************************************/
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "assert.h"
+#include "session.h"
+
+/* Marks the start and end of a recording */
+#define HEADER_MAGIC "UMREC01\n"
+#define TRAILER_MAGIC "UMRECEND"
+#define MAGIC_LENGTH 8
+/* Number of 64-bit numbers in the trailer */
+#define TRAILER_FIELDS 4
+/* Number of marks room is first made for */
+#define INITIAL_MARKS 64
+/* Parameters of the 64-bit FNV-1a hash */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/*   session
+ *   A recording being made or a recording being replayed
+ *    
+ *   Elements:
+ *      bool replaying:          whether this is a replay
+ *      FILE *fp:                the recording being written
+ *      uint64_t *marks:         the marks taken so far, two numbers each
+ *      uint64_t num_marks:      the number of marks taken
+ *      uint64_t mark_capacity:  the number of marks there is room for
+ *      uint64_t start_ns:       when the run started
+ *      bool output_since_input: whether OUT ran since the last IN
+ *      unsigned char *map:      the mapped recording being replayed
+ *      size_t map_length:       the size of the mapping
+ *      const unsigned char *input: the recorded input within the mapping
+ *      uint64_t input_length:   the number of bytes of input
+ *      uint64_t input_offset:   the number of input bytes used so far
+ *      bool checked:            whether the recording has a trailer to 
+ *                               check the output against
+ *      uint64_t expected_length: the output length that was recorded
+ *      uint64_t expected_checksum: the output checksum that was recorded
+ *      uint64_t output_length:  the number of bytes written by OUT
+ *      uint64_t output_checksum: the FNV-1a hash of those bytes
+ *  
+ */
+struct session {
+        bool replaying;
+        FILE *fp;
+        uint64_t *marks;
+        uint64_t num_marks;
+        uint64_t mark_capacity;
+        uint64_t start_ns;
+        bool output_since_input;
+        unsigned char *map;
+        size_t map_length;
+        const unsigned char *input;
+        uint64_t input_length;
+        uint64_t input_offset;
+        bool checked;
+        uint64_t expected_length;
+        uint64_t expected_checksum;
+        uint64_t output_length;
+        uint64_t output_checksum;
+};
+
+/********** now_ns ********
+* Purpose:
+*      Reads the monotonic clock
+* Inputs:
+*      
+* Return/Effects:
+*      Returns the current time in nanoseconds
+* Expects:
+*      
+* Notes
+*      
+************************/
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/********** session_new ********
+* Purpose:
+*      Allocates a session with nothing recorded or replayed yet
+* Inputs:
+*      bool replaying: Whether the session is a replay
+* Return/Effects:
+*      Returns the new session
+* Expects:
+*      
+* Notes
+*      
+************************/
+static session *session_new(bool replaying)
+{
+        session *s = calloc(1, sizeof(*s));
+        assert(s != NULL);
+        s->replaying = replaying;
+        s->output_since_input = true;
+        s->output_checksum = FNV_OFFSET;
+        return s;
+}
+
+
+/********** session_record ********
+* Purpose:
+*      Starts recording a run
+* Inputs:
+*      const char *filename: Where the recording is written
+* Return/Effects:
+*      Returns a session that records every byte read through session_getc
+* Expects:
+*      filename to be writable
+* Notes
+*      
+************************/
+session *session_record(const char *filename)
+{
+        assert(filename != NULL);
+        session *s = session_new(false);
+        s->fp = fopen(filename, "wb");
+        assert(s->fp != NULL);
+        size_t n = fwrite(HEADER_MAGIC, 1, MAGIC_LENGTH, s->fp);
+        assert(n == MAGIC_LENGTH);
+        int ret = fflush(s->fp);
+        assert(ret == 0);
+        s->mark_capacity = INITIAL_MARKS;
+        s->marks = malloc(2 * s->mark_capacity * sizeof(uint64_t));
+        assert(s->marks != NULL);
+        s->start_ns = now_ns();
+        return s;
+}
+
+
+/********** read_trailer ********
+* Purpose:
+*      Reads the trailer of a mapped recording
+* Inputs:
+*      session *s: The replay, with the recording mapped
+* Return/Effects:
+*      Returns whether the recording ends in a trailer that accounts for 
+*      every byte of the file. If so, fills in the input length, mark count
+*      and expected output of s.
+* Expects:
+*      
+* Notes
+*      The fields come from the file, so each one is checked against the 
+*      space left for it before anything is added up.
+************************/
+static bool read_trailer(session *s)
+{
+        size_t trailer = TRAILER_FIELDS * sizeof(uint64_t) + MAGIC_LENGTH;
+        if (s->map_length < MAGIC_LENGTH + trailer) {
+                return false;
+        }
+        const unsigned char *end = s->map + s->map_length;
+        if (memcmp(end - MAGIC_LENGTH, TRAILER_MAGIC, MAGIC_LENGTH) != 0) {
+                return false;
+        }
+        uint64_t fields[TRAILER_FIELDS];
+        memcpy(fields, end - trailer, sizeof(fields));
+        /* The input and marks must exactly fill the body */
+        uint64_t body = s->map_length - MAGIC_LENGTH - trailer;
+        if (fields[0] > body) {
+                return false;
+        }
+        uint64_t mark_bytes = body - fields[0];
+        if (mark_bytes % (2 * sizeof(uint64_t)) != 0 || 
+                        fields[1] != mark_bytes / (2 * sizeof(uint64_t))) {
+                return false;
+        }
+        s->input_length = fields[0];
+        s->num_marks = fields[1];
+        s->expected_length = fields[2];
+        s->expected_checksum = fields[3];
+        return true;
+}
+
+
+/********** session_replay ********
+* Purpose:
+*      Starts replaying a recorded run
+* Inputs:
+*      const char *filename: The recording
+* Return/Effects:
+*      Returns a session that feeds the recorded input to session_getc
+* Expects:
+*      filename to be a recording
+* Notes
+*      The recording is mapped rather than read, so the input is never 
+*      copied. A recording without a trailer, or with one that does not 
+*      match the size of the file, was cut short. All of it after the 
+*      magic is then replayed as input and the output is not checked.
+************************/
+session *session_replay(const char *filename)
+{
+        assert(filename != NULL);
+        session *s = session_new(true);
+        int fd = open(filename, O_RDONLY);
+        assert(fd >= 0);
+        struct stat buf;
+        int ret = fstat(fd, &buf);
+        assert(ret == 0);
+        assert((size_t) buf.st_size >= MAGIC_LENGTH);
+        s->map_length = buf.st_size;
+        s->map = mmap(NULL, s->map_length, PROT_READ, MAP_PRIVATE, fd, 0);
+        assert(s->map != MAP_FAILED);
+        close(fd);
+        assert(memcmp(s->map, HEADER_MAGIC, MAGIC_LENGTH) == 0);
+        s->input = s->map + MAGIC_LENGTH;
+        s->checked = read_trailer(s);
+        if (!s->checked) {
+                s->input_length = s->map_length - MAGIC_LENGTH;
+                s->num_marks = 0;
+                fprintf(stderr, "replay: %s was cut short, replaying its "
+                        "%" PRIu64 " bytes of input without checking the "
+                        "output\n", filename, s->input_length);
+        }
+        return s;
+}
+
+
+/********** session_getc ********
+* Purpose:
+*      Reads a byte of input for IN
+* Inputs:
+*      session *s: The session
+*      FILE *in: The machine's input, used only when recording
+* Return/Effects:
+*      Returns the next input byte, or EOF at the end of input. A recording 
+*      saves the byte and takes a mark if OUT ran since the last IN.
+* Expects:
+*      
+* Notes
+*      A recorded byte is flushed straight away so that it survives the run
+*      being killed. That costs a write per byte, but only while recording.
+************************/
+int session_getc(session *s, FILE *in)
+{
+        assert(s != NULL);
+        if (s->replaying) {
+                if (s->input_offset == s->input_length) {
+                        return EOF;
+                }
+                return s->input[s->input_offset++];
+        }
+        int c = getc(in);
+        if (s->output_since_input) {
+                if (s->num_marks == s->mark_capacity) {
+                        s->mark_capacity *= 2;
+                        s->marks = realloc(s->marks, 
+                                2 * s->mark_capacity * sizeof(uint64_t));
+                        assert(s->marks != NULL);
+                }
+                s->marks[2 * s->num_marks] = s->input_offset;
+                s->marks[2 * s->num_marks + 1] = now_ns() - s->start_ns;
+                s->num_marks++;
+                s->output_since_input = false;
+        }
+        if (c != EOF) {
+                int ret = putc(c, s->fp);
+                assert(ret != EOF);
+                ret = fflush(s->fp);
+                assert(ret == 0);
+                s->input_offset++;
+        }
+        return c;
+}
+
+
+/********** session_putc ********
+* Purpose:
+*      Notes a byte written by OUT
+* Inputs:
+*      session *s: The session
+*      int c: The byte written
+* Return/Effects:
+*      Adds the byte to the output length and checksum
+* Expects:
+*      
+* Notes
+*      
+************************/
+void session_putc(session *s, int c)
+{
+        assert(s != NULL);
+        s->output_checksum = (s->output_checksum ^ (unsigned char) c) * 
+                                                                FNV_PRIME;
+        s->output_length++;
+        s->output_since_input = true;
+}
+
+
+/********** session_close ********
+* Purpose:
+*      Ends a session
+* Inputs:
+*      session **s: The session
+* Return/Effects:
+*      A recording writes its marks and trailer. A replay of a complete 
+*      recording compares the output against it and reports any difference
+*      on stderr. Returns false only if a replay produced different output.
+*      Frees the session and sets *s to NULL.
+* Expects:
+*      
+* Notes
+*      
+************************/
+bool session_close(session **s)
+{
+        assert(s != NULL && *s != NULL);
+        session *sess = *s;
+        bool matched = true;
+        if (sess->replaying) {
+                matched = !sess->checked || 
+                        (sess->output_length == sess->expected_length &&
+                        sess->output_checksum == sess->expected_checksum);
+                if (!matched) {
+                        fprintf(stderr, "replay: output differs from the "
+                                "recording (%" PRIu64 " bytes, checksum "
+                                "%016" PRIx64 ", expected %" PRIu64 
+                                " bytes, checksum %016" PRIx64 ")\n",
+                                sess->output_length, sess->output_checksum,
+                                sess->expected_length, 
+                                sess->expected_checksum);
+                }
+                munmap(sess->map, sess->map_length);
+        } else {
+                size_t n = fwrite(sess->marks, 2 * sizeof(uint64_t), 
+                                                sess->num_marks, sess->fp);
+                assert(n == sess->num_marks);
+                uint64_t fields[TRAILER_FIELDS] = {
+                        sess->input_offset, sess->num_marks, 
+                        sess->output_length, sess->output_checksum
+                };
+                n = fwrite(fields, sizeof(uint64_t), TRAILER_FIELDS, 
+                                                                sess->fp);
+                assert(n == TRAILER_FIELDS);
+                n = fwrite(TRAILER_MAGIC, 1, MAGIC_LENGTH, sess->fp);
+                assert(n == MAGIC_LENGTH);
+                int ret = fclose(sess->fp);
+                assert(ret == 0);
+                free(sess->marks);
+        }
+        free(sess);
+        *s = NULL;
+        return matched;
+}
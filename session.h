@@ -0,0 +1,27 @@
+/**************************************************************
+ *
+ *                     session.h
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Interface of the session module, which records and replays
+ *              the I/O of a UM run
+ *
+ **************************************************************/
+#ifndef SESSION_H_INCLUDED
+#define SESSION_H_INCLUDED
+
+#include <stdio.h>
+#include <stdbool.h>
+
+typedef struct session session;
+
+session *session_record(const char *filename);
+session *session_replay(const char *filename);
+int session_getc(session *s, FILE *in);
+void session_putc(session *s, int c);
+bool session_close(session **s);
+
+#endif
@@ -0,0 +1,268 @@
+/**************************************************************
+ *
+ *                     stats.c
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Keeps the runtime counters of the UM and writes them out in 
+ *              a line based format. Each line of a dump is a name and a 
+ *              value separated by a space, and a blank line ends the dump.
+ *
+ **************************************************************/
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "assert.h"
+#include "stats.h"
+
+/* Number of opcodes the UM defines */
+#define NUM_UM_OPCODES 14
+/* Room for a whole dump, which is about 500 bytes */
+#define DUMP_BYTES 2048
+/* Room for a 64-bit number in decimal */
+#define NUMBER_DIGITS 20
+
+/* The counters SIGUSR1 dumps */
+static um_stats *signal_stats = NULL;
+
+static const char *opcode_names[NUM_UM_OPCODES] = {
+        "CMOV", "SLOAD", "SSTORE", "ADD", "MUL", "DIV", "NAND",
+        "HALT", "MAP", "UNMAP", "OUT", "IN", "LOADP", "LV"
+};
+
+/********** stats_map ********
+* Purpose:
+*      Records a newly mapped segment
+* Inputs:
+*      um_stats *stats: The counters of the running UM
+*      unsigned num_words: The number of words in the new segment
+* Return/Effects:
+*      Updates the live and peak segment and word counts
+* Expects:
+*      
+* Notes
+*      
+************************/
+void stats_map(um_stats *stats, unsigned num_words)
+{
+        assert(stats != NULL);
+        stats->live_segments++;
+        stats->live_words += num_words;
+        if (stats->live_segments > stats->peak_segments) {
+                stats->peak_segments = stats->live_segments;
+        }
+        if (stats->live_words > stats->peak_words) {
+                stats->peak_words = stats->live_words;
+        }
+}
+
+
+/********** stats_unmap ********
+* Purpose:
+*      Records an unmapped segment
+* Inputs:
+*      um_stats *stats: The counters of the running UM
+*      unsigned num_words: The number of words in the unmapped segment
+* Return/Effects:
+*      Updates the live segment and word counts
+* Expects:
+*      The segment to have been recorded with stats_map
+* Notes
+*      
+************************/
+void stats_unmap(um_stats *stats, unsigned num_words)
+{
+        assert(stats != NULL);
+        assert(stats->live_segments > 0);
+        assert(stats->live_words >= num_words);
+        stats->live_segments--;
+        stats->live_words -= num_words;
+}
+
+
+/********** append_line ********
+* Purpose:
+*      Adds one "name value" line to a dump being built
+* Inputs:
+*      char *buf: The dump, DUMP_BYTES long
+*      size_t len: The number of bytes already in buf
+*      const char *prefix: The start of the name
+*      const char *name: The rest of the name
+*      uint64_t value: The value
+* Return/Effects:
+*      Returns the new length of the dump. A line that does not fit is cut 
+*      short.
+* Expects:
+*      
+* Notes
+*      Uses nothing but plain loops so that it can run in a signal handler.
+************************/
+static size_t append_line(char *buf, size_t len, const char *prefix, 
+                                        const char *name, uint64_t value)
+{
+        char digits[NUMBER_DIGITS];
+        int num_digits = 0;
+        do {
+                digits[num_digits++] = '0' + value % 10;
+                value /= 10;
+        } while (value > 0);
+        for (; *prefix != '\0' && len < DUMP_BYTES; prefix++) {
+                buf[len++] = *prefix;
+        }
+        for (; *name != '\0' && len < DUMP_BYTES; name++) {
+                buf[len++] = *name;
+        }
+        if (len < DUMP_BYTES) {
+                buf[len++] = ' ';
+        }
+        while (num_digits > 0 && len < DUMP_BYTES) {
+                buf[len++] = digits[--num_digits];
+        }
+        if (len < DUMP_BYTES) {
+                buf[len++] = '\n';
+        }
+        return len;
+}
+
+
+/********** format_dump ********
+* Purpose:
+*      Builds a dump of the counters
+* Inputs:
+*      char *buf: Where the dump is built, DUMP_BYTES long
+*      const um_stats *stats: The counters of the running UM
+* Return/Effects:
+*      Fills buf with one "name value" line per counter followed by a blank
+*      line, and returns its length
+* Expects:
+*      
+* Notes
+*      Instructions retired is the sum of the per opcode totals, so it is 
+*      not counted separately. Safe to call from a signal handler.
+************************/
+static size_t format_dump(char *buf, const um_stats *stats)
+{
+        uint64_t retired = 0;
+        for (int i = 0; i < NUM_OPCODES; i++) {
+                retired += stats->opcodes[i];
+        }
+        size_t len = append_line(buf, 0, "um.", "instructions_retired", 
+                                                                retired);
+        for (int i = 0; i < NUM_UM_OPCODES; i++) {
+                len = append_line(buf, len, "um.opcode.", opcode_names[i], 
+                                                        stats->opcodes[i]);
+        }
+        len = append_line(buf, len, "um.", "segments.live", 
+                                                        stats->live_segments);
+        len = append_line(buf, len, "um.", "segments.peak", 
+                                                        stats->peak_segments);
+        len = append_line(buf, len, "um.", "words.live", stats->live_words);
+        len = append_line(buf, len, "um.", "words.peak", stats->peak_words);
+        len = append_line(buf, len, "um.", "unmapped", stats->unmapped);
+        len = append_line(buf, len, "um.", "segment_loads", 
+                                                        stats->segment_loads);
+        len = append_line(buf, len, "um.", "bytes_in", stats->bytes_in);
+        len = append_line(buf, len, "um.", "bytes_out", stats->bytes_out);
+        len = append_line(buf, len, "um.", "code_cache.hits", 
+                                                stats->code_cache_hits);
+        len = append_line(buf, len, "um.", "code_cache.misses", 
+                                                stats->code_cache_misses);
+        if (len < DUMP_BYTES) {
+                buf[len++] = '\n';
+        }
+        return len;
+}
+
+
+/********** dump_on_signal ********
+* Purpose:
+*      The SIGUSR1 handler
+* Inputs:
+*      int signum: The signal that was caught
+* Return/Effects:
+*      Writes a dump of the counters to stderr
+* Expects:
+*      stats_install_signal to have been called
+* Notes
+*      The dump is built on the stack and written with write(2), so it 
+*      never touches stdio and works while IN is blocked. A counter the UM 
+*      was part way through updating may be off by one instruction.
+************************/
+static void dump_on_signal(int signum)
+{
+        (void) signum;
+        int saved_errno = errno;
+        char buf[DUMP_BYTES];
+        size_t len = format_dump(buf, signal_stats);
+        size_t done = 0;
+        while (done < len) {
+                ssize_t n = write(STDERR_FILENO, buf + done, len - done);
+                if (n < 0 && errno == EINTR) {
+                        continue;
+                }
+                if (n <= 0) {
+                        break;
+                }
+                done += n;
+        }
+        errno = saved_errno;
+}
+
+
+/********** stats_install_signal ********
+* Purpose:
+*      Makes SIGUSR1 dump the counters
+* Inputs:
+*      um_stats *stats: The counters of the running UM
+* Return/Effects:
+*      Installs the SIGUSR1 handler
+* Expects:
+*      stats to outlive the run
+* Notes
+*      SA_RESTART keeps a pending IN or OUT from failing when the signal 
+*      arrives. The handler writes the dump itself, so nothing waits on 
+*      the blocked call to finish.
+************************/
+void stats_install_signal(um_stats *stats)
+{
+        assert(stats != NULL);
+        signal_stats = stats;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = dump_on_signal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        int ret = sigaction(SIGUSR1, &action, NULL);
+        assert(ret == 0);
+}
+
+
+/********** stats_dump ********
+* Purpose:
+*      Writes out the counters
+* Inputs:
+*      FILE *fp: Where the dump is written
+*      um_stats *stats: The counters of the running UM
+* Return/Effects:
+*      Writes one "name value" line per counter followed by a blank line
+* Expects:
+*      
+* Notes
+*      Uses the same format as the SIGUSR1 dump.
+************************/
+void stats_dump(FILE *fp, um_stats *stats)
+{
+        assert(fp != NULL);
+        assert(stats != NULL);
+        char buf[DUMP_BYTES];
+        size_t len = format_dump(buf, stats);
+        fwrite(buf, 1, len, fp);
+        fflush(fp);
+}
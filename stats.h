@@ -0,0 +1,60 @@
+/**************************************************************
+ *
+ *                     stats.h
+ *
+ *     Assignment: UM
+ *     Authors:  John Berg (jberg02), Alex Shriver (ashriv02)
+ *     Date:    04.12.23
+ *
+ *     Purpose: Interface of the runtime statistics module
+ *
+ **************************************************************/
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Number of values a 4-bit opcode can take */
+#define NUM_OPCODES 16
+
+/*   um_stats
+ *   Counters that are always kept while the UM runs. They are cheap enough 
+ *   to leave on and are dumped on demand with stats_dump.
+ *    
+ *   Elements:
+ *      uint64_t opcodes[]:      instructions retired, per opcode
+ *      uint64_t live_segments:  segments currently mapped, including $m[0]
+ *      uint64_t peak_segments:  the most segments ever mapped at once
+ *      uint64_t live_words:     words held by the mapped segments
+ *      uint64_t peak_words:     the most words ever mapped at once
+ *      uint64_t unmapped:       segment IDs waiting on the unmapped list
+ *      uint64_t segment_loads:  LOADP instructions that replaced $m[0]
+ *      uint64_t bytes_in:       bytes read by IN, not counting end of input
+ *      uint64_t bytes_out:      bytes written by OUT
+ *      uint64_t code_cache_hits:   programs loaded with a cached decoding
+ *      uint64_t code_cache_misses: programs that had to be decoded
+ *  
+ */
+struct um_stats {
+        uint64_t opcodes[NUM_OPCODES];
+        uint64_t live_segments;
+        uint64_t peak_segments;
+        uint64_t live_words;
+        uint64_t peak_words;
+        uint64_t unmapped;
+        uint64_t segment_loads;
+        uint64_t bytes_in;
+        uint64_t bytes_out;
+        uint64_t code_cache_hits;
+        uint64_t code_cache_misses;
+};
+
+typedef struct um_stats um_stats;
+
+void stats_map(um_stats *stats, unsigned num_words);
+void stats_unmap(um_stats *stats, unsigned num_words);
+void stats_install_signal(um_stats *stats);
+void stats_dump(FILE *fp, um_stats *stats);
+
+#endif